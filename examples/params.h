@@ -15,21 +15,68 @@
 // Number of nodes you want to create
 #define NNodes        64
 
+// Node lattice. If NodeFile is not empty,  the NNodes node positions are read
+// from it (increasing, the last one at Lz). Otherwise the nodes are
+//   z_mu = Lz (s - NodeStretch sin(2 pi s) / (2 pi)),  s = (mu+1)/NNodes
+// a regular lattice for NodeStretch = 0, finer near z = 0 and z = Lz (and
+// coarser in the center) for 0 < NodeStretch < 1
+#define NodeFile      ""
+#define NodeStretch   0.0
+
+// Shape functions of the nodes: LinearBasis (hat functions), QuadraticBasis
+// or CubicBasis (B-splines, smoother profiles with less nodes)
+#define LinearBasis    1
+#define QuadraticBasis 2
+#define CubicBasis     3
+#define NodeBasis      LinearBasis
+
+// Project the profiles with the mass matrix of the shape functions instead of
+// dividing by the node volumes (lumped mass matrix). Its factorization is done
+// once. Projected profiles are more accurate, but may oscillate (or be slightly
+// negative) where they change abruptly
+#define __MASS_MATRIX__ false
+
 // Size of the simulation box
 #define Lx            40.0  
 #define Ly            40.0
 #define Lz            16.0
 
-// Interaction parameters of LJ
-#define m1             1.0
-#define m2             1.34
+// Number of atom types, and the types that make the fluid (the particles that
+// feel the wall force and give the meso fields) and the walls
+#define NTypes         2
+#define FluidTypes     { 2 }
+#define WallTypes      { 1 }
+
+// Largest cut-off radius of all the pairs (used to build the cells)
 #define Rcut           2.5
-#define e1             1.0
-#define e2             5.2895
-#define e12            2.2998
-#define s1             1.0 
-#define s2             1.1205
-#define s12            1.0602
+
+// Interaction parameters of LJ for each type (from type 1 to type NTypes)
+#define TypeMass       {    1.0,   1.34 }
+#define TypeEpsilon    {    1.0, 5.2895 }
+#define TypeSigma      {    1.0, 1.1205 }
+
+// Mixing rule for unlike pairs that are not given in PairCoeffs
+//   LorentzBerthelot: epsilon_ij = sqrt(e_i e_j), sigma_ij = (s_i + s_j)/2
+//   Geometric:        epsilon_ij = sqrt(e_i e_j), sigma_ij = sqrt(s_i s_j)
+#define LorentzBerthelot 0
+#define Geometric        1
+#define MixingRule     LorentzBerthelot
+
+// Explicit pair coefficients (as pair_coeff in lammps). They override the
+// mixing rule. Each row is {type1, type2, epsilon, sigma, rcut} (rcut <= Rcut)
+#define PairCoeffs     { { 1, 2, 2.2998, 1.0602, Rcut } }
+
+// Tabulated pairs (as pair_style table in lammps, e.g. tables written with
+// pair_write for WCA or Morse potentials). They replace the LJ interaction of
+// the pair. Each row is {type1, type2, "file", "KEYWORD"}
+#define PairTables     { { 0, 0, "", "" } }
+
+// Number of intervals of the cubic spline (in r^2) used for tabulated pairs
+#define PairTableN     4000
+
+// Shift the LJ energy to zero at the cut-off of each pair
+// (use true if shift yes is specified in lammps)
+#define ShiftLJ        true
 
 // Number of cells in which the simulation box is splitted 
 // (Do not change)
@@ -37,13 +84,6 @@
 #define My     (int) (Ly/Rcut)
 #define Mz     (int) (Lz/Rcut)
 
-// Cut-energy in the LJ potential
-// (used if shift yes is specified in lammps)
-// (Do not change)
-#define ecut1          ((double)  4.0*e1*(pow( s1/Rcut,12)-pow( s1/Rcut,6)))
-#define ecut2          ((double)  4.0*e2*(pow( s2/Rcut,12)-pow( s2/Rcut,6)))
-#define ecut12         ((double) 4.0*e12*(pow(s12/Rcut,12)-pow(s12/Rcut,6)))
-
 // Computations to be done
 #define true  1
 #define false 0
@@ -60,3 +100,161 @@
 #define __COMPUTE_MACRO_MOMENTUM__  true
 #define __COMPUTE_CENTER_OF_MASS__  true
 
+// Groups of atoms for the macroscopic energy, momentum and center of mass (the
+// wall energy needs __COMPUTE_MACRO_ENERGY__). Each row is
+//   {"Name", type, zmin, zmax, idmin, idmax}
+// and selects the atoms of the type (0: all, FluidType or WallType: all the
+// fluid or wall types) with zmin <= z < zmax and idmin <= id < idmax  (row in
+// the input files,  from 0).  GroupRegion(g, x, y, z) adds any other condition
+// on the position for group g (e.g. a cylinder).
+#define AtomGroups      { { "UpperWall", WallType, Lz/2.0,  HUGE_VAL, 0, NParticles }, \
+                          { "LowerWall", WallType, -HUGE_VAL, Lz/2.0, 0, NParticles } }
+#define GroupRegion(g, x, y, z) true
+
+// Force and torque (about the center of mass of the group) that the fluid
+// exerts on the atoms of each group that are not fluid (the walls),  and their
+// interaction energy.  The positions are those in the box (not unwrapped)
+#define __COMPUTE_WALL_FORCES__     false
+
+// (Do not change)
+#define __COMPUTE_MACRO__ (__COMPUTE_MACRO_ENERGY__ || __COMPUTE_MACRO_MOMENTUM__ || \
+                           __COMPUTE_CENTER_OF_MASS__ || __COMPUTE_WALL_FORCES__)
+
+// Kinetic stress and temperature relative to the local streaming velocity u,
+// obtained from the moments  sum m,  sum m v  and  sum m v v  of each node  in
+// a single pass:  sum m (v-u)(v-u) = sum m v v - (sum m v)(sum m v) / sum m
+#define __PECULIAR_VELOCITIES__     false
+
+// Pressure tensor P_xz, P_yz, P_zz at the node planes by the method of planes.
+// The kinetic part counts the crossings between consecutive snapshots, which
+// are SnapshotDt apart
+#define __COMPUTE_MOP__             false
+#define SnapshotDt                  1.0
+
+// Heat flux (energy current) of the fluid,  convective and virial parts.  The
+// virial part is accumulated in the same pair loop as the virial stress
+#define __COMPUTE_HEAT_FLUX__       false
+
+// Time correlations C_mu,nu(t) = <dA_mu(t) dB_nu(0)> of the meso fields for lags
+// t < CorrelationMaxLag (in snapshots),  computed with FFTs. Each row of
+// CorrelationPairs is {A, B}.  The density,  momentum and energy (MesoEnergy +
+// MesoKinetic) need __COMPUTE_DENSITY__, __COMPUTE_MOMENTUM__ and
+// __COMPUTE_ENERGY__
+#define __COMPUTE_CORRELATIONS__    false
+#define CorrDensity                 0
+#define CorrMomentumX               1
+#define CorrMomentumY               2
+#define CorrMomentumZ               3
+#define CorrEnergy                  4
+#define CorrelationPairs            { { CorrDensity, CorrDensity }, { CorrMomentumZ, CorrMomentumZ }, \
+                                      { CorrEnergy,  CorrEnergy  }, { CorrEnergy,    CorrDensity   } }
+#define CorrelationMaxLag           256
+
+// Equal time covariance matrices <dA_mu dA_nu> of the same fields,  and their
+// eigenvalues. CovarianceBatch snapshots are added at once (BLAS dsyrk)
+#define __COMPUTE_COVARIANCE__      false
+#define CovarianceBatch             64
+
+// Streaming proper orthogonal decomposition of the same fields: the PODRank
+// leading modes of the fluctuations and their singular values, updated with a
+// thin SVD (LAPACK) every PODBlock snapshots (the memory does not grow with NSteps)
+#define __COMPUTE_POD__             false
+#define PODRank                     8
+#define PODBlock                    16
+
+// Mean squared displacement and velocity autocorrelation of the fluid by
+// element,  with a multiple tau correlator:  MultipleTauP values per level,
+// each level averages MultipleTauM values of the previous one (MultipleTauP
+// must be a multiple of MultipleTauM). The positions are unwrapped, so the
+// atoms must move less than half the box between snapshots
+#define __COMPUTE_MULTIPLE_TAU__    false
+#define MultipleTauP                16
+#define MultipleTauM                2
+
+// In-plane structure factor S(k) of the fluid in each element. The particles
+// are assigned to a SkGridNx x SkGridNy grid (powers of 2) with NGP (1), CIC
+// (2) or TSC (3),  and S(k) is averaged in SkBins shells of |k|
+#define __COMPUTE_LAYER_SK__        false
+#define SkGridNx                    64
+#define SkGridNy                    64
+#define SkAssignment                3
+#define SkBins                      64
+
+// Radial distribution functions g(r) by pair of types and element of the
+// central atom, in RdfBins bins up to RdfRmax (<= Rcut).  The central atoms are
+// those of RdfCenters (0: all, FluidType, WallType or a type),  with any force
+// engine. The pairs of the fluid are counted in the force loop,  the others in
+// a separate sweep
+#define __COMPUTE_RDF__             false
+#define RdfBins                     100
+#define RdfRmax                     Rcut
+#define RdfCenters                  FluidType
+
+// Compare the virial stress tensor (bond splitting) with the former zmuij
+// implementation on the first snapshot, and report timings and differences
+#define __BENCHMARK_SIGMA2__        false
+
+// Store the particles along a Morton curve  (better cache locality in the
+// neighbor search). Results do not depend on this option
+#define __SPATIAL_ORDER__           true
+
+// Tabulated wall potential for rigid (or nearly rigid) walls.  The force
+// that the walls  exert on the  fluid is interpolated  from a grid  built  with
+// the first snapshot.  If any wall atom moves more than  WallGridTol  from  its
+// reference position, the exact pair evaluation is used in that snapshot.
+// Wall pairs closer than WallGridRcore are linearized before tabulating (the
+// fluid never gets there). The run stops if the error of the grid force on the
+// fluid of the first snapshot exceeds WallGridMaxError times the max. force.
+#define __WALL_GRID__               false
+#define WallGridNx                  160
+#define WallGridNy                  160
+#define WallGridNz                  128
+#define WallGridTol                 0.05
+#define WallGridRcore               0.85
+#define WallGridMaxError            0.1
+
+// Cluster-pair engine for the forces (instead of per-particle Verlet lists).
+// Particles are grouped in clusters of ClusterSize (4 or 8) and the forces are
+// evaluated in ClusterSize x ClusterSize tiles.  With __BENCHMARK_FORCES__ both
+// engines are run and compared on the first snapshot
+#define __CLUSTER_PAIRS__           false
+#define ClusterSize                 4
+#define __BENCHMARK_FORCES__        false
+
+// Spatial domain decomposition of the force loop. Each thread owns a z-slab of
+// cells with the same estimated cost (based on the local density) and works on
+// a private copy of its cells and their halo. Ignored with __CLUSTER_PAIRS__
+#define __DOMAIN_DECOMPOSITION__    false
+
+// Store the particle data of the cluster-pair and domain engines in float and
+// evaluate the LJ pair forces in float (tables and accumulators are always in
+// double). It needs __CLUSTER_PAIRS__ or __DOMAIN_DECOMPOSITION__.  With
+// __VALIDATE_PRECISION__
+// the forces are also computed in double each snapshot and the largest relative
+// deviation of the particle forces, MesoForce, MesoEnergy and the convective
+// heat flux is printed.  The stresses,  the virial heat flux and the method of
+// planes are always computed in double
+#define __SINGLE_PRECISION__        false
+#define __VALIDATE_PRECISION__      false
+
+// NUMA nodes: per-atom arrays are spread over the nodes,  one block of rows per
+// thread (first touch), and threads can be pinned to cpus:
+//   PlacementNone:    no pinning
+//   PlacementCompact: fill the cpus of a NUMA node before the next one
+//   PlacementSpread:  deal the threads round robin over the NUMA nodes
+// Only the cpus allowed to the process (cpuset, batch scheduler or taskset) are
+// used, and the threads are not pinned if there are less of them than threads.
+// OMP_PROC_BIND / OMP_PLACES, if set, have priority over ThreadPlacement
+#define PlacementNone               0
+#define PlacementCompact            1
+#define PlacementSpread             2
+#define __NUMA_AWARE__              true
+#define ThreadPlacement             PlacementNone
+
+// Two and three dimensional meso grids. Nodes are the tensor product of GridNx
+// regular nodes in x, GridNy in y and the NNodes of the lattice in z (GridNy = 1
+// gives x-z maps). The time averaged density, momentum, energies and stress of
+// the fluid are saved at the end of the run
+#define __MESO_GRID__               false
+#define GridNx                      32
+#define GridNy                      1
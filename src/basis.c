@@ -0,0 +1,275 @@
+/*
+ * Filename   : basis.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 23:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Shape functions of the nodes (linear, quadratic and cubic
+ *              B-splines) shared by the Compute_Meso_* kernels
+ *
+ */
+
+#include "cg.h"
+
+// The shape functions are B-splines of degree NodeBasis of the node coordinate
+// u, which runs from mu to mu+1 along element mu (linearly in z), so node mu is
+// at u = mu.  On a regular lattice they are the usual cardinal B-splines.  Any
+// degree gives a partition of unity, so the particles are conserved.  The
+// BasisSupport nodes of a particle are First, First+1, ... (mod NNodes)
+
+double Basis_Coordinate(gsl_vector * z, double zi)
+{
+  int muRight = Node_Right(z, zi);
+
+  // zi = Lz is the last node
+  if (muRight == NNodes)
+    return NNodes-1;
+
+  // PBC: the element below the first node is the last one (from z = Lz = 0)
+  double zLeft = (muRight == 0) ? 0.0 : gsl_vector_get(z,muRight-1);
+  int    e     = (muRight == 0) ? NNodes-1 : muRight-1;
+  return e + (zi - zLeft)/Lattice.h[muRight];
+}
+
+// Weights of the nodes of a particle at node coordinate u (W[s*Stride])
+
+static inline int Basis_Polynomials(double u, double * W, int Stride)
+{
+  // t in [0,1) is the position with respect to the first node (shifted by half
+  // a node for the quadratic basis, which is centered at the nearest node)
+  double v     = u - 0.5*(NodeBasis-1);
+  double f     = floor(v);
+  double t     = v - f;
+  int    First = (int) f;
+
+  #if NodeBasis == QuadraticBasis
+    W[0]        = 0.5*(1.0-t)*(1.0-t);
+    W[Stride]   = 0.5 + t*(1.0-t);
+    W[2*Stride] = 0.5*t*t;
+  #elif NodeBasis == CubicBasis
+    double s    = 1.0 - t;
+    W[0]        = s*s*s/6.0;
+    W[Stride]   = (4.0 + t*t*(3.0*t - 6.0))/6.0;
+    W[2*Stride] = (1.0 + 3.0*t*(1.0 + t*s))/6.0;
+    W[3*Stride] = t*t*t/6.0;
+  #else
+    W[0]        = 1.0 - t;
+    W[Stride]   = t;
+  #endif
+
+  return (First + NNodes) % NNodes;
+}
+
+int Basis_Weights(gsl_vector * z, double zi, double * w)
+{
+  return Basis_Polynomials(Basis_Coordinate(z, zi), w, 1);
+}
+
+void Basis_Weights_Block(gsl_vector * z, int n, const double * zi, int * First, double * W)
+{
+  double u[BasisChunk];
+
+  // The lookup of the element is a gather, the polynomials are vectorized
+  for (int k=0;k<n;k++)
+    u[k] = Basis_Coordinate(z, zi[k]);
+
+  #pragma omp simd
+  for (int k=0;k<n;k++)
+    First[k] = Basis_Polynomials(u[k], W + k, BasisChunk);
+}
+
+void Basis_Scatter(gsl_matrix * Positions, const int * Index, int n, gsl_vector * z,
+                   const double * Micro, size_t Stride, double * Meso, size_t MesoStride)
+{
+  int    First[BasisChunk];
+  double W[BasisSupport*BasisChunk];
+  double zi[BasisChunk];
+  double a[BasisChunk];
+
+  for (int k0=0;k0<n;k0+=BasisChunk)
+  {
+    int m = min(BasisChunk, n-k0);
+    for (int k=0;k<m;k++)
+    {
+      int i = (Index == NULL) ? k0+k : Index[k0+k];
+      zi[k] = gsl_matrix_get(Positions,i,3);
+      a[k]  = (Micro == NULL) ? 1.0 : Micro[i*Stride];
+    }
+
+    Basis_Weights_Block(z, m, zi, First, W);
+
+    for (int k=0;k<m;k++)
+      for (int s=0;s<BasisSupport;s++)
+        Meso[((First[k]+s) % NNodes)*MesoStride] += a[k]*W[s*BasisChunk+k];
+  }
+}
+
+void Compute_Basis_Volumes(void)
+{
+  // Two point Gauss-Legendre rule on each half of the elements.  The weights
+  // are polynomials of degree <= 3 in each half, so the integrals are exact
+  const double g[2] = {0.5 - 0.5/sqrt(3.0), 0.5 + 0.5/sqrt(3.0)};
+  double w[BasisSupport];
+
+  for (int mu=0;mu<NNodes;mu++)
+    Lattice.Volume[mu] = 0.0;
+
+  for (int e=0;e<NNodes;e++)
+  {
+    // Element e has width h[e+1] (from node e to node e+1)
+    double h = Lattice.h[(e+1)%NNodes];
+    for (int half=0;half<2;half++)
+    {
+      for (int q=0;q<2;q++)
+      {
+        double u     = e + 0.5*(half + g[q]);
+        int    First = Basis_Polynomials(u, w, 1);
+        for (int s=0;s<BasisSupport;s++)
+          Lattice.Volume[(First+s)%NNodes] += Lx*Ly*0.25*h*w[s];
+      }
+    }
+  }
+}
+
+/* #############################################################################
+#  Mass matrix projection
+############################################################################# */
+
+// The mass matrix of a periodic lattice is banded except for the corners that
+// couple the first and the last nodes. Its Cholesky factor keeps the envelope
+// of the matrix (the first nonzero of each row), so only the band and the
+// last rows are filled, and a solve costs O(n p) for half bandwidth p.
+
+struct MassMatrix NodeMass;
+
+void Factor_MassMatrix(struct MassMatrix * M, int n, const double * A)
+{
+  M->n     = n;
+  M->First = malloc(n*sizeof(int));
+  M->L     = calloc(n*n, sizeof(double));
+
+  for (int i=0;i<n;i++)
+  {
+    M->First[i] = i;
+    for (int j=0;j<i;j++)
+    {
+      if (A[i*n+j] != 0.0)
+      {
+        M->First[i] = j;
+        break;
+      }
+    }
+  }
+
+  for (int i=0;i<n;i++)
+  {
+    for (int j=M->First[i];j<=i;j++)
+    {
+      double s = A[i*n+j];
+      for (int k=max(M->First[i],M->First[j]);k<j;k++)
+        s -= M->L[i*n+k]*M->L[j*n+k];
+
+      if (j < i)
+      {
+        M->L[i*n+j] = s/M->L[j*n+j];
+      }
+      else if (s > 0.0)
+      {
+        M->L[i*n+i] = sqrt(s);
+      }
+      else
+      {
+        PrintMsg("Error in the mass matrix: it is not positive definite. Exiting now...");
+        printf("\tRow %d of %d\n", i, n);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+}
+
+void Solve_MassMatrix(struct MassMatrix * M, double * b, size_t Stride)
+{
+  int      n = M->n;
+  double * L = M->L;
+
+  // L y = b
+  for (int i=0;i<n;i++)
+  {
+    double s = b[i*Stride];
+    for (int k=M->First[i];k<i;k++)
+      s -= L[i*n+k]*b[k*Stride];
+    b[i*Stride] = s/L[i*n+i];
+  }
+
+  // L^T x = y (by columns of L^T, i.e. rows of L)
+  for (int i=n-1;i>=0;i--)
+  {
+    b[i*Stride] /= L[i*n+i];
+    for (int k=M->First[i];k<i;k++)
+      b[k*Stride] -= L[i*n+k]*b[i*Stride];
+  }
+}
+
+void FreeMassMatrix(struct MassMatrix * M)
+{
+  free(M->First);
+  free(M->L);
+}
+
+void Compute_Basis_MassMatrix(void)
+{
+  // Four point Gauss-Legendre rule on each half of the elements (exact for the
+  // products of two cubic B-splines)
+  const double g[4] = {0.5 - 0.5*0.8611363115940526, 0.5 - 0.5*0.3399810435848563,
+                       0.5 + 0.5*0.3399810435848563, 0.5 + 0.5*0.8611363115940526};
+  const double c[4] = {0.5*0.3478548451374538, 0.5*0.6521451548625461,
+                       0.5*0.6521451548625461, 0.5*0.3478548451374538};
+  double   w[BasisSupport];
+  double * A = calloc(NNodes*NNodes, sizeof(double));
+
+  for (int e=0;e<NNodes;e++)
+  {
+    double h = Lattice.h[(e+1)%NNodes];
+    for (int half=0;half<2;half++)
+    {
+      for (int q=0;q<4;q++)
+      {
+        double u     = e + 0.5*(half + g[q]);
+        int    First = Basis_Polynomials(u, w, 1);
+        for (int s=0;s<BasisSupport;s++)
+          for (int t=0;t<BasisSupport;t++)
+            A[((First+s)%NNodes)*NNodes + (First+t)%NNodes] += Lx*Ly*0.5*h*c[q]*w[s]*w[t];
+      }
+    }
+  }
+
+  Factor_MassMatrix(&NodeMass, NNodes, A);
+  free(A);
+}
+
+void Compute_Hat_MassMatrix(struct MassMatrix * M, int n, double d)
+{
+  // Linear elements of width d on a periodic regular lattice of n nodes
+  double * A = calloc(n*n, sizeof(double));
+  for (int i=0;i<n;i++)
+  {
+    A[i*n+i]         += 2.0*d/3.0;
+    A[i*n+(i+1)%n]   += d/6.0;
+    A[i*n+(i+n-1)%n] += d/6.0;
+  }
+  Factor_MassMatrix(M, n, A);
+  free(A);
+}
+
+void Basis_Normalize(double * Meso, size_t Stride)
+{
+  #if __MASS_MATRIX__
+    Solve_MassMatrix(&NodeMass, Meso, Stride);
+  #else
+    for (int mu=0;mu<NNodes;mu++)
+      Meso[mu*Stride] /= Lattice.Volume[mu];
+  #endif
+}
@@ -0,0 +1,192 @@
+/*
+ * Filename   : bonds.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : mar 20 oct 2026 10:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Splitting of the bonds among the elements (virial stress) and
+ *              the node planes (method of planes) they cross, and benchmark
+ *              against zmuij
+ *
+ */
+
+#include "cg.h"
+
+// The elements are consecutive intervals of z: element NNodes-1 spans from 0 to
+// z[0], and element mu < NNodes-1 from z[mu] to z[mu+1] (z[NNodes-2] to Lz for
+// the last one).  The bond is walked from its lower end, and the fraction in
+// each element is the overlap with its edges over the length of the bond.
+
+int Bond_Split(gsl_vector * z, double zi, double dz, int * Element, double * Fraction)
+{
+  // A bond in the xy plane belongs to the element of its ends
+  if (fabs(dz) <= 1e-10)
+  {
+    double zc   = zi - Lz*floor(zi/Lz);
+    Element[0]  = Element_Of(z, zc);
+    Fraction[0] = 1.0;
+    return 1;
+  }
+
+  double lo     = (dz > 0.0) ? zi : zi + dz;
+  double hi     = (dz > 0.0) ? zi + dz : zi;
+  double il     = 1.0/fabs(dz);
+  double offset = Lz*floor(lo/Lz);
+  int    e      = Element_Of(z, lo - offset);
+  int    n      = 0;
+  double a      = lo;
+
+  while (n < NNodes+1)
+  {
+    double Upper = offset + ((e == NNodes-1) ? gsl_vector_get(z,0) : gsl_vector_get(z,e+1));
+    double b     = min(hi, Upper);
+    Element[n]   = e;
+    Fraction[n]  = (b - a)*il;
+    n++;
+    if (Upper >= hi)
+      break;
+
+    // Next element up (PBC: above the element that ends at Lz, the one at 0)
+    a = Upper;
+    if (e == NNodes-2)
+    {
+      e       = NNodes-1;
+      offset += Lz;
+    }
+    else
+    {
+      e = (e == NNodes-1) ? 0 : e+1;
+    }
+  }
+  return n;
+}
+
+int Bond_Planes(gsl_vector * z, double zi, double dz, int * Node)
+{
+  if (dz == 0.0)
+    return 0;
+
+  // Node planes in (lo, hi], and their periodic images
+  double lo     = (dz > 0.0) ? zi : zi + dz;
+  double hi     = (dz > 0.0) ? zi + dz : zi;
+  double offset = Lz*floor(lo/Lz);
+  int    mu     = Node_Right(z, lo - offset);
+  int    n      = 0;
+
+  while (n < NNodes)
+  {
+    if (mu == NNodes)
+    {
+      mu      = 0;
+      offset += Lz;
+    }
+    double p = gsl_vector_get(z,mu) + offset;
+    if (p > hi)
+      break;
+    if (p > lo)
+      Node[n++] = mu;
+    mu++;
+  }
+  return n;
+}
+
+// Previous implementation: every element between the ones of i and j, weighted
+// with zmuij (the bond goes from zi to zj without the periodic images)
+
+void Compute_Meso_Sigma2_zmuij(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                               gsl_vector * List, struct TypeList * Types, gsl_matrix * MesoSigma2,
+                               gsl_vector * z)
+{
+  gsl_matrix_set_zero(MesoSigma2);
+
+  #pragma omp parallel
+  {
+    double * Local  = calloc(9*NNodes, sizeof(double));
+    int    * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz));
+
+    #pragma omp for schedule(static)
+    for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+    {
+      int    i     = Types->Index[k];
+      double zi    = gsl_matrix_get(Positions,i,3);
+      int    mu    = Element_Of(z, zi);
+      int    iCell = FindParticle(Positions,i);
+      gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
+      int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+
+      for (int j=0;j<NNeighbors;j++)
+      {
+        if (!IsOfType((int) gsl_matrix_get(Positions,Verlet[j],0), FluidType))
+          continue;
+
+        double zj = gsl_matrix_get(Positions,Verlet[j],3);
+        int    nu = Element_Of(z, zj);
+
+        double fij[3], rij[3];
+        Compute_Force_ij (Positions, i, Verlet[j], FluidType, FluidType, fij);
+        rij[0]  = gsl_matrix_get(Positions,i,1) - gsl_matrix_get(Positions,Verlet[j],1);
+        rij[0] -= Lx*round(rij[0]/Lx);
+        rij[1]  = gsl_matrix_get(Positions,i,2) - gsl_matrix_get(Positions,Verlet[j],2);
+        rij[1] -= Ly*round(rij[1]/Ly);
+        rij[2]  = zi - zj;
+        rij[2] -= Lz*round(rij[2]/Lz);
+
+        for (int sigma=((int)min(mu,nu)); sigma<=((int)max(mu,nu));sigma++)
+        {
+          double zsigma = zmuij(z,sigma,zi,zj);
+          for (int a=0;a<3;a++)
+            for (int b=0;b<3;b++)
+              Local[9*sigma+3*a+b] += rij[a]*fij[b]*zsigma;
+        }
+      }
+    }
+
+    #pragma omp critical
+    for (int l=0;l<9*NNodes;l++)
+      MesoSigma2->data[(l/9)*MesoSigma2->tda + l%9] += Local[l];
+
+    free(Local);
+    free(Verlet);
+  }
+
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    gsl_vector_view row = gsl_matrix_row(MesoSigma2,mu);
+    gsl_vector_scale(&row.vector,0.5/Element_Volume(mu));
+  }
+}
+
+void Check_Sigma2(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                  gsl_vector * List, struct TypeList * Types, gsl_vector * z)
+{
+  gsl_matrix * Sigma1 = gsl_matrix_calloc(NNodes,9);
+  gsl_matrix * Sigma2 = gsl_matrix_calloc(NNodes,9);
+
+  double t0 = omp_get_wtime();
+  Compute_Meso_Sigma2_zmuij(Positions, Neighbors, ListHead, List, Types, Sigma1, z);
+  double t1 = omp_get_wtime();
+  Compute_Meso_Sigma2(Positions, NULL, Neighbors, ListHead, List, Types, Sigma2, NULL, z);
+  double t2 = omp_get_wtime();
+
+  double MaxError = 0.0;
+  double MaxSigma = 0.0;
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    for (int l=0;l<9;l++)
+    {
+      MaxError = max(MaxError, fabs(gsl_matrix_get(Sigma1,mu,l) - gsl_matrix_get(Sigma2,mu,l)));
+      MaxSigma = max(MaxSigma, fabs(gsl_matrix_get(Sigma1,mu,l)));
+    }
+  }
+
+  printf("\tzmuij:          %f s\n", t1-t0);
+  printf("\tBond splitting: %f s\n", t2-t1);
+  printf("\tMax. difference in the virial stress: %e (max. stress: %e)\n", MaxError, MaxSigma);
+  printf("\t(bonds across z = 0 differ: zmuij does not use their periodic image)\n");
+
+  gsl_matrix_free(Sigma1);
+  gsl_matrix_free(Sigma2);
+}
@@ -20,6 +20,8 @@ int main (int argc, char *argv[]) {
 
   PrintComputingOptions();
 
+  Setup_Threads();
+
   PrintMsg("INIT");
 
   char * filestr;
@@ -190,26 +192,48 @@ int main (int argc, char *argv[]) {
     sprintf(str, "./output/%s.MesoInternalEnergy.dat", filestr);
     oFile.MesoInternalEnergy = fopen(str, "w");
   #endif
-    
-  #if __COMPUTE_MACRO_ENERGY__
-    sprintf(str, "./output/%s.MacroEnergyUpperWall.dat", filestr);
-    oFile.MacroEnergyUpperWall = fopen(str, "w");
-    sprintf(str, "./output/%s.MacroEnergyLowerWall.dat", filestr);
-    oFile.MacroEnergyLowerWall = fopen(str, "w");
-  #endif
-  
-  #if __COMPUTE_MACRO_MOMENTUM__
-    sprintf(str, "./output/%s.MacroMomentumUpperWall.dat", filestr);
-    oFile.MacroMomentumUpperWall = fopen(str, "w");
-    sprintf(str, "./output/%s.MacroMomentumLowerWall.dat", filestr);
-    oFile.MacroMomentumLowerWall = fopen(str, "w");
+
+  #if __COMPUTE_MOP__
+    // Kinetic part of the method of planes
+    sprintf(str, "./output/%s.MesoMOP1_xz.dat", filestr);
+    oFile.MesoMOP1_0 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoMOP1_yz.dat", filestr);
+    oFile.MesoMOP1_1 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoMOP1_zz.dat", filestr);
+    oFile.MesoMOP1_2 = fopen(str, "w");
+
+    // Configurational part of the method of planes
+    sprintf(str, "./output/%s.MesoMOP2_xz.dat", filestr);
+    oFile.MesoMOP2_0 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoMOP2_yz.dat", filestr);
+    oFile.MesoMOP2_1 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoMOP2_zz.dat", filestr);
+    oFile.MesoMOP2_2 = fopen(str, "w");
   #endif
 
-  #if __COMPUTE_CENTER_OF_MASS__
-    sprintf(str, "./output/%s.CenterOfMassUpperWall.dat", filestr);
-    oFile.CenterOfMassUpperWall = fopen(str, "w");
-    sprintf(str, "./output/%s.CenterOfMassLowerWall.dat", filestr);
-    oFile.CenterOfMassLowerWall = fopen(str, "w");
+  #if __COMPUTE_HEAT_FLUX__
+    // Convective part of the heat flux
+    sprintf(str, "./output/%s.MesoHeat1_x.dat", filestr);
+    oFile.MesoHeat1_0 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoHeat1_y.dat", filestr);
+    oFile.MesoHeat1_1 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoHeat1_z.dat", filestr);
+    oFile.MesoHeat1_2 = fopen(str, "w");
+
+    // Virial part of the heat flux
+    sprintf(str, "./output/%s.MesoHeat2_x.dat", filestr);
+    oFile.MesoHeat2_0 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoHeat2_y.dat", filestr);
+    oFile.MesoHeat2_1 = fopen(str, "w");
+    sprintf(str, "./output/%s.MesoHeat2_z.dat", filestr);
+    oFile.MesoHeat2_2 = fopen(str, "w");
+  #endif
+    
+  // Groups of atoms of the macroscopic quantities (a file per group and
+  // quantity)
+  #if __COMPUTE_MACRO__
+    struct GroupList Groups;
+    AllocGroups(&Groups, filestr);
   #endif
   
   // END OF BLOCK. All output files created
@@ -223,34 +247,66 @@ int main (int argc, char *argv[]) {
   sprintf(str, "./output/%s.MesoNodes.dat", filestr);
   SaveVectorWithoutIndex(z, str);
 
+  PrintMsg("Building the table of pair parameters...");
+  Compute_PairTable();
+
   PrintMsg("Obtaining neighboring matrix...");
-  gsl_matrix * Neighbors = gsl_matrix_calloc (Mx*My*Mz,27);
+  gsl_matrix * Neighbors = AllocMatrix (Mx*My*Mz,27);
   Compute_NeighborMatrix(Neighbors);
 
   // END OF BLOCK. All constant quantities created
 
   // BEGIN OF BLOCK. Definition of needed vectors, matrices, and so on
 
-  // Positions, velocities and momentum
-  gsl_matrix * PositionsBase  = gsl_matrix_calloc (NParticles,5);
-  gsl_matrix * VelocitiesBase = gsl_matrix_calloc (NParticles,5);
+  // Positions, velocities and momentum. Per-atom arrays are first touched by
+  // the threads that work on them (see numa.c)
+  gsl_matrix * PositionsBase  = AllocMatrix (NParticles,5);
+  gsl_matrix * VelocitiesBase = AllocMatrix (NParticles,5);
 
-  gsl_matrix * Positions  = gsl_matrix_calloc (NParticles,4);
+  gsl_matrix * Positions  = AllocMatrix (NParticles,4);
 
-  gsl_matrix * Velocities = gsl_matrix_calloc (NParticles,3);
-  gsl_matrix * Momentum   = gsl_matrix_calloc (NParticles,3);
+  gsl_matrix * Velocities = AllocMatrix (NParticles,3);
+  gsl_matrix * Momentum   = AllocMatrix (NParticles,3);
 
   FILE *PositionsFile;
   FILE *VelocitiesFile;
 
+  // Per-type index lists
+  struct TypeList Types;
+  Types.Index = AllocArray(NParticles, sizeof(int));
+
+  // Spatial order of the particles (identity if they are not reordered)
+  struct Ordering Order;
+  Order.Id  = AllocArray(NParticles, sizeof(int));
+  Order.Row = AllocArray(NParticles, sizeof(int));
+  Compute_Identity_Order(&Order);
+
+  // Tabulated wall potential (built with the first snapshot)
+  #if __WALL_GRID__
+    struct WallGrid Grid;
+  #endif
+
+  // Cluster-pair engine
+  #if __CLUSTER_PAIRS__ || __BENCHMARK_FORCES__
+    struct ClusterList Clusters;
+    AllocClusterList(&Clusters);
+  #endif
+
   // Linked list
-  gsl_vector * List      = gsl_vector_calloc (NParticles);
-  gsl_vector * ListHead  = gsl_vector_calloc (Mx*My*Mz);
+  gsl_vector * List      = AllocVector (NParticles);
+  gsl_vector * ListHead  = AllocVector (Mx*My*Mz);
 
   // Microscopic variables
-  gsl_matrix * Force   = gsl_matrix_calloc (NParticles,3);
-  gsl_vector * Energy  = gsl_vector_calloc (NParticles);
-  gsl_vector * Kinetic = gsl_vector_calloc (NParticles);
+  gsl_matrix * Force   = AllocMatrix (NParticles,3);
+  gsl_vector * Energy  = AllocVector (NParticles);
+  gsl_vector * Kinetic = AllocVector (NParticles);
+
+  // Force and energy of the fluid on the other particles (forces on the walls)
+  #if __COMPUTE_WALL_FORCES__
+    gsl_matrix * Cross = AllocMatrix (NParticles,4);
+  #else
+    gsl_matrix * Cross = NULL;
+  #endif
 
   // Mesoscopic variables
   gsl_matrix * MesoForce     = gsl_matrix_calloc (NNodes,3);
@@ -265,12 +321,85 @@ int main (int argc, char *argv[]) {
   gsl_matrix * MesoSigma1   = gsl_matrix_calloc (NNodes,9);
   gsl_matrix * MesoSigma2   = gsl_matrix_calloc (NNodes,9);
   gsl_matrix * MesoSigma    = gsl_matrix_calloc (NNodes,9);
+
+  // With peculiar velocities the temperature is obtained in the pass of the
+  // kinetic stress
+  #if __PECULIAR_VELOCITIES__ && __COMPUTE_TEMPERATURE__
+    gsl_vector * PeculiarTemp = MesoTemp;
+  #elif __PECULIAR_VELOCITIES__
+    gsl_vector * PeculiarTemp = NULL;
+  #endif
   
   gsl_matrix * MesoMomentum = gsl_matrix_calloc (NNodes,3);
   gsl_matrix * MesoVelocity = gsl_matrix_calloc (NNodes,3);
   
   gsl_vector * MesoInternalEnergy = gsl_vector_calloc (NNodes);
 
+  // Method of planes: P_xz, P_yz and P_zz at the node planes.  MOPPrevious keeps
+  // z and the velocity of the previous snapshot (by row in the input files)
+  gsl_matrix * MesoMOP1    = gsl_matrix_calloc (NNodes,3);
+  gsl_matrix * MesoMOP2    = gsl_matrix_calloc (NNodes,3);
+  #if __COMPUTE_MOP__
+    gsl_matrix * MOPPrevious = AllocMatrix (NParticles,4);
+  #endif
+
+  // Heat flux (x, y, z). The virial part is computed with the virial stress
+  gsl_matrix * MesoHeat1 = gsl_matrix_calloc (NNodes,3);
+  gsl_matrix * MesoHeat2 = gsl_matrix_calloc (NNodes,3);
+  #if __COMPUTE_HEAT_FLUX__
+    gsl_matrix * HeatFlux2 = MesoHeat2;
+  #else
+    gsl_matrix * HeatFlux2 = NULL;
+  #endif
+
+  // Time correlations of the meso fields
+  #if __COMPUTE_CORRELATIONS__
+    struct Correlations Corr;
+    AllocCorrelations(&Corr);
+  #endif
+  #if __COMPUTE_COVARIANCE__
+    struct Covariance Cov;
+    AllocCovariance(&Cov);
+  #endif
+
+  // Streaming POD of the meso fields
+  #if __COMPUTE_POD__
+    struct StreamingPOD Pod;
+    AllocPOD(&Pod);
+  #endif
+
+  // Mean squared displacement and velocity autocorrelation
+  #if __COMPUTE_MULTIPLE_TAU__
+    struct MultipleTau MTau;
+    AllocMultipleTau(&MTau);
+  #endif
+
+  // Structure factor of the layers
+  #if __COMPUTE_LAYER_SK__
+    struct LayerSk Sk;
+    AllocLayerSk(&Sk);
+  #endif
+
+  // Radial distribution functions (histograms of the fluid filled by the force
+  // loop of the Verlet list engine, the rest by Compute_RDF)
+  #if __COMPUTE_RDF__
+    struct RDF Rdf;
+    AllocRDF(&Rdf, z);
+  #endif
+  #if !(__CLUSTER_PAIRS__ || __DOMAIN_DECOMPOSITION__)
+    #if __COMPUTE_RDF__
+      struct RDF * ForceRdf = &Rdf;
+    #else
+      struct RDF * ForceRdf = NULL;
+    #endif
+  #endif
+
+  // Two and three dimensional meso fields (time averaged)
+  #if __MESO_GRID__
+    struct MesoGrid Mesh;
+    AllocMesoGrid(&Mesh);
+  #endif
+
 
   // END OF BLOCK
 
@@ -310,6 +439,7 @@ int main (int argc, char *argv[]) {
         // all the atom inside the box
         PrintMsg("Fixing PBC in the positions file...");
         FixPBC(Positions);
+
       }
       //pragma omp section
       {
@@ -331,12 +461,25 @@ int main (int argc, char *argv[]) {
         gsl_matrix_set_col(Velocities,2,&Velocity_2.vector);
 
         fclose(VelocitiesFile);
-
-        // Compute microscopic momentum
-        Compute_Momentum(Positions,Velocities,Momentum);
       }
     }
 
+    // Store the particles along a space filling curve. From here on, row i
+    // holds particle Order.Id[i] of the input files
+    #if __SPATIAL_ORDER__
+      PrintMsg("Sorting particles along a Morton curve...");
+      Compute_Spatial_Order(Positions, &Order);
+      Apply_Order(&Order, Positions);
+      Apply_Order(&Order, Velocities);
+    #endif
+
+    // Kernels that deal with a single type of atom only visit its range
+    PrintMsg("Building per-type index lists...");
+    Compute_TypeList(Positions, &Types);
+
+    // Compute microscopic momentum
+    Compute_Momentum(Positions,Velocities,Momentum);
+
     PrintMsg("Obtaining linked list...");
     Compute_Linked_List(Positions, List, ListHead);
 
@@ -358,8 +501,68 @@ int main (int argc, char *argv[]) {
     //      j = gsl_vector_get(List,j);
     //     } 
     
-    PrintMsg("Computing forces in the fluid (type 2 particles) due to the wall (type 1 particles)");
-    Compute_Forces(Positions, Velocities, Neighbors, ListHead, List, 2, 1, Force, Energy, Kinetic);
+    // The wall grid is only used while the wall stays close to the reference
+    // configuration. Otherwise the exact pair evaluation is done
+    struct WallGrid * ForceGrid = NULL;
+    #if __WALL_GRID__
+      if (Step == 0)
+      {
+        PrintMsg("Building the wall grid from the first snapshot...");
+        Compute_WallGrid(Positions, Neighbors, ListHead, List, &Types, &Order, &Grid);
+        Check_WallGrid(Positions, Neighbors, ListHead, List, &Types, &Grid);
+      }
+      double WallDrift = Compute_WallGrid_Drift(Positions, &Types, &Order, &Grid);
+      if (WallDrift <= WallGridTol)
+      {
+        ForceGrid = &Grid;
+      }
+      else
+      {
+        PrintMsg("Wall drift exceeds WallGridTol. Using exact wall forces in this snapshot");
+        printf("\tMax. wall displacement: %f\n", WallDrift);
+      }
+    #endif
+
+    #if __BENCHMARK_FORCES__
+      if (Step == 0)
+      {
+        PrintMsg("Comparing the Verlet list and cluster-pair force engines...");
+        Check_ClusterForces(Positions, Velocities, Neighbors, ListHead, List, &Types, &Clusters, FluidType, WallType, ForceGrid);
+      }
+    #endif
+
+    PrintMsg("Computing forces in the fluid due to the wall");
+    #if __CLUSTER_PAIRS__
+      Compute_ClusterList(Positions, Neighbors, ListHead, List, &Clusters);
+      Compute_Forces_Cluster(Velocities, &Clusters, FluidType, WallType, ForceGrid, Force, Energy, Kinetic);
+    #elif __DOMAIN_DECOMPOSITION__
+      double Imbalance = Compute_Forces_Domain(Positions, Velocities, Neighbors, ListHead, List, FluidType, WallType, ForceGrid, Force, Energy, Kinetic);
+      printf("\tEstimated load imbalance: %f\n", Imbalance);
+    #else
+      Compute_Forces(Positions, Velocities, Neighbors, ListHead, List, &Types, FluidType, WallType, ForceGrid, ForceRdf, Force, Energy, Kinetic);
+    #endif
+
+    // The force loops only visit the fluid
+    #if __COMPUTE_MACRO_ENERGY__ || __COMPUTE_WALL_FORCES__
+      PrintMsg("Computing the energies of the walls and the forces of the fluid on them...");
+      Compute_Walls(Positions, Velocities, Neighbors, ListHead, List, &Types, FluidType, Cross, Energy, Kinetic);
+    #endif
+
+    // Central atoms of the radial distribution functions that the force loop
+    // did not histogram (all of them with the cluster-pair and domain engines)
+    #if __COMPUTE_RDF__
+      PrintMsg("Obtaining the pair histograms of the radial distribution functions...");
+      #if __CLUSTER_PAIRS__ || __DOMAIN_DECOMPOSITION__
+        Compute_RDF(Positions, Neighbors, ListHead, List, &Types, -1, &Rdf);
+      #else
+        Compute_RDF(Positions, Neighbors, ListHead, List, &Types, FluidType, &Rdf);
+      #endif
+    #endif
+
+    #if __VALIDATE_PRECISION__
+      PrintMsg("Validating the forces against the double precision path...");
+      Check_Precision(Positions, Velocities, Neighbors, ListHead, List, &Types, z, FluidType, WallType, ForceGrid, Force, Energy);
+    #endif
     
     // Checkpoint: Compare velocities and momentum
     //     gsl_vector_view  gx = gsl_matrix_column(Momentum,0);
@@ -397,7 +600,7 @@ int main (int argc, char *argv[]) {
     //     gsl_vector_free (vr);
 
     // Checkpoint: Find the neighboring cells of the cell in which a TestParticle is into
-    //    int TestParticle = 14412;
+    //    int TestParticle = Order.Row[14412];
     //    printf("TESTING PARTICLE %d (type %d) at (%f,%f,%f)\n", TestParticle, ((int) gsl_matrix_get(Positions,TestParticle,0)), 
     //        gsl_matrix_get(Positions,TestParticle,1), gsl_matrix_get(Positions,TestParticle,2), gsl_matrix_get(Positions,TestParticle,3));
     //    int TestCell = FindParticle(Positions,TestParticle);
@@ -462,9 +665,9 @@ int main (int argc, char *argv[]) {
       #pragma omp section
       {
         PrintMsg("Obtaining node densities...");
-        Compute_Meso_Density(Positions, z, 1, MesoDensity_1);
+        Compute_Meso_Density(Positions, &Types, z, WallType, MesoDensity_1);
         PrintInfo(Step, MesoDensity_1, oFile.MesoDensity_1);
-        Compute_Meso_Density(Positions, z, 2, MesoDensity_2);
+        Compute_Meso_Density(Positions, &Types, z, FluidType, MesoDensity_2);
         PrintInfo(Step, MesoDensity_2, oFile.MesoDensity_2);
         gsl_vector_memcpy(MesoDensity_0, MesoDensity_1);
         gsl_vector_add(MesoDensity_0, MesoDensity_2);
@@ -488,7 +691,7 @@ int main (int argc, char *argv[]) {
       #pragma omp section
       {
         PrintMsg("Obtaining node energies...");
-        Compute_Meso_Profile(Positions, Energy, z, MesoEnergy, 2);
+        Compute_Meso_Profile(Positions, &Types, Energy, z, MesoEnergy, FluidType);
         PrintInfo(Step, MesoEnergy, oFile.MesoEnergy);
       }
       #endif
@@ -499,17 +702,17 @@ int main (int argc, char *argv[]) {
 
         gsl_vector_view MesoMomentum_0  = gsl_matrix_column(MesoMomentum,0);
         gsl_vector_view Momentum_0      = gsl_matrix_column(Momentum,0);
-        Compute_Meso_Profile(Positions, &Momentum_0.vector, z, &MesoMomentum_0.vector, 2);
+        Compute_Meso_Profile(Positions, &Types, &Momentum_0.vector, z, &MesoMomentum_0.vector, FluidType);
         PrintInfo(Step, &MesoMomentum_0.vector, oFile.MesoMomentum_0);
         
         gsl_vector_view MesoMomentum_1  = gsl_matrix_column(MesoMomentum,1);
         gsl_vector_view Momentum_1      = gsl_matrix_column(Momentum,1);
-        Compute_Meso_Profile(Positions, &Momentum_1.vector, z, &MesoMomentum_1.vector, 2);
+        Compute_Meso_Profile(Positions, &Types, &Momentum_1.vector, z, &MesoMomentum_1.vector, FluidType);
         PrintInfo(Step, &MesoMomentum_1.vector, oFile.MesoMomentum_1);
         
         gsl_vector_view MesoMomentum_2  = gsl_matrix_column(MesoMomentum,2);
         gsl_vector_view Momentum_2      = gsl_matrix_column(Momentum,2);
-        Compute_Meso_Profile(Positions, &Momentum_2.vector, z, &MesoMomentum_2.vector, 2);
+        Compute_Meso_Profile(Positions, &Types, &Momentum_2.vector, z, &MesoMomentum_2.vector, FluidType);
         PrintInfo(Step, &MesoMomentum_2.vector, oFile.MesoMomentum_2);
       }
       #endif
@@ -531,7 +734,7 @@ int main (int argc, char *argv[]) {
       #pragma omp section
       {
         PrintMsg("Obtaining node kinetic energies...");
-        Compute_Meso_Profile(Positions, Kinetic, z, MesoKinetic, 2);
+        Compute_Meso_Profile(Positions, &Types, Kinetic, z, MesoKinetic, FluidType);
         PrintInfo(Step, MesoKinetic, oFile.MesoKinetic);
       }
       #endif
@@ -539,7 +742,11 @@ int main (int argc, char *argv[]) {
       #pragma omp section
       {
         PrintMsg("Obtaining node kinetic stress tensors...");
-        Compute_Meso_Sigma1(Positions, Velocities, MesoSigma1);
+        #if __PECULIAR_VELOCITIES__
+          Compute_Meso_Peculiar(Positions, Velocities, &Types, MesoSigma1, PeculiarTemp, z);
+        #else
+          Compute_Meso_Sigma1(Positions, Velocities, &Types, MesoSigma1, z);
+        #endif
         gsl_matrix_memcpy(MesoSigma,MesoSigma1);
 
         gsl_vector_view  MesoSigma1_00 = gsl_matrix_column(MesoSigma1,0);
@@ -564,10 +771,21 @@ int main (int argc, char *argv[]) {
       #endif
     }
 
-    #if __COMPUTE_STRESS__
+    #if __COMPUTE_STRESS__ || __COMPUTE_HEAT_FLUX__
       PrintMsg("Obtaining node virial stress tensor...");
 
-      Compute_Meso_Sigma2(Positions, Neighbors, ListHead, List, MesoSigma2, z);
+      #if __BENCHMARK_SIGMA2__
+        if (Step == 0)
+        {
+          PrintMsg("Comparing bond splitting and zmuij for the virial stress...");
+          Check_Sigma2(Positions, Neighbors, ListHead, List, &Types, z);
+        }
+      #endif
+
+      Compute_Meso_Sigma2(Positions, Velocities, Neighbors, ListHead, List, &Types, MesoSigma2, HeatFlux2, z);
+    #endif
+
+    #if __COMPUTE_STRESS__
       gsl_matrix_add (MesoSigma, MesoSigma2);
 
       gsl_vector_view  MesoSigma2_00 = gsl_matrix_column(MesoSigma2,0);
@@ -611,9 +829,52 @@ int main (int argc, char *argv[]) {
       PrintInfo(Step, &MesoSigma_22.vector, oFile.MesoSigma_22);
     #endif
 
+    #if __COMPUTE_MOP__
+      PrintMsg("Obtaining the pressure tensor at the node planes (method of planes)...");
+
+      Compute_Meso_MOP(Positions, Neighbors, ListHead, List, &Types, z, MesoMOP2);
+      Compute_Meso_MOP_Kinetic(Positions, Velocities, &Types, &Order, z, MOPPrevious, Step, MesoMOP1);
+
+      gsl_vector_view  MesoMOP1_0 = gsl_matrix_column(MesoMOP1,0);
+      PrintInfo(Step, &MesoMOP1_0.vector, oFile.MesoMOP1_0);
+      gsl_vector_view  MesoMOP1_1 = gsl_matrix_column(MesoMOP1,1);
+      PrintInfo(Step, &MesoMOP1_1.vector, oFile.MesoMOP1_1);
+      gsl_vector_view  MesoMOP1_2 = gsl_matrix_column(MesoMOP1,2);
+      PrintInfo(Step, &MesoMOP1_2.vector, oFile.MesoMOP1_2);
+      gsl_vector_view  MesoMOP2_0 = gsl_matrix_column(MesoMOP2,0);
+      PrintInfo(Step, &MesoMOP2_0.vector, oFile.MesoMOP2_0);
+      gsl_vector_view  MesoMOP2_1 = gsl_matrix_column(MesoMOP2,1);
+      PrintInfo(Step, &MesoMOP2_1.vector, oFile.MesoMOP2_1);
+      gsl_vector_view  MesoMOP2_2 = gsl_matrix_column(MesoMOP2,2);
+      PrintInfo(Step, &MesoMOP2_2.vector, oFile.MesoMOP2_2);
+    #endif
+
+    #if __COMPUTE_HEAT_FLUX__
+      PrintMsg("Obtaining node heat flux...");
+
+      Compute_Meso_HeatFlux1(Positions, Velocities, &Types, Energy, Kinetic, MesoHeat1, z);
+
+      gsl_vector_view  MesoHeat1_0 = gsl_matrix_column(MesoHeat1,0);
+      PrintInfo(Step, &MesoHeat1_0.vector, oFile.MesoHeat1_0);
+      gsl_vector_view  MesoHeat1_1 = gsl_matrix_column(MesoHeat1,1);
+      PrintInfo(Step, &MesoHeat1_1.vector, oFile.MesoHeat1_1);
+      gsl_vector_view  MesoHeat1_2 = gsl_matrix_column(MesoHeat1,2);
+      PrintInfo(Step, &MesoHeat1_2.vector, oFile.MesoHeat1_2);
+      gsl_vector_view  MesoHeat2_0 = gsl_matrix_column(MesoHeat2,0);
+      PrintInfo(Step, &MesoHeat2_0.vector, oFile.MesoHeat2_0);
+      gsl_vector_view  MesoHeat2_1 = gsl_matrix_column(MesoHeat2,1);
+      PrintInfo(Step, &MesoHeat2_1.vector, oFile.MesoHeat2_1);
+      gsl_vector_view  MesoHeat2_2 = gsl_matrix_column(MesoHeat2,2);
+      PrintInfo(Step, &MesoHeat2_2.vector, oFile.MesoHeat2_2);
+    #endif
+
     #if __COMPUTE_TEMPERATURE__
       PrintMsg("Obtaining node temperature...");
-      Compute_Meso_Temp(MesoKinetic, MesoDensity_2, MesoTemp);
+      #if !__PECULIAR_VELOCITIES__
+        Compute_Meso_Temp(MesoKinetic, MesoDensity_2, MesoTemp);
+      #elif !__COMPUTE_STRESS__
+        Compute_Meso_Peculiar(Positions, Velocities, &Types, NULL, MesoTemp, z);
+      #endif
       PrintInfo(Step, MesoTemp, oFile.MesoTemp);
     #endif
         
@@ -622,67 +883,41 @@ int main (int argc, char *argv[]) {
       Compute_InternalEnergy(MesoEnergy, MesoMomentum, MesoDensity_2, MesoInternalEnergy);
       PrintInfo(Step, MesoInternalEnergy, oFile.MesoInternalEnergy);
     #endif
-    
-    // MACROSCOPIC INFORMATION
 
-    #if __COMPUTE_MACRO_ENERGY__
-      double MacroEnergy;
-
-      PrintMsg("Computing the energy of upper wall");
-      MacroEnergy = Compute_Macro(Energy, Positions, 1, "top");
-      PrintScalarWithIndex(Step, MacroEnergy, oFile.MacroEnergyUpperWall); 
+    #if __MESO_GRID__
+      PrintMsg("Obtaining the fields of the meso grid...");
+      Compute_MesoGrid(Positions, Velocities, Momentum, Energy, Kinetic, Neighbors, ListHead, List, &Types, z, FluidType, &Mesh);
+    #endif
 
-      PrintMsg("Computing the energy of lower wall");
-      MacroEnergy = Compute_Macro(Energy, Positions, 1, "bottom");
-      PrintScalarWithIndex(Step, MacroEnergy, oFile.MacroEnergyLowerWall); 
+    #if __COMPUTE_CORRELATIONS__
+      Compute_Correlations(&Corr, MesoDensity_2, MesoMomentum, MesoEnergy, MesoKinetic);
     #endif
 
-    #if __COMPUTE_MACRO_MOMENTUM__
-      double TemporalMomentum;
+    #if __COMPUTE_COVARIANCE__
+      Compute_Covariance(&Cov, MesoDensity_2, MesoMomentum, MesoEnergy, MesoKinetic);
+    #endif
 
-      gsl_vector * MacroMomentum = gsl_vector_calloc(3);
-    
-      gsl_vector_view Momentum_0 = gsl_matrix_column(Momentum,0);
-      gsl_vector_view Momentum_1 = gsl_matrix_column(Momentum,1);
-      gsl_vector_view Momentum_2 = gsl_matrix_column(Momentum,2);
-      
-      PrintMsg("Computing the momentum of upper wall");
-      
-      TemporalMomentum = Compute_Macro(&Momentum_0.vector, Positions, 1, "top"); 
-      gsl_vector_set(MacroMomentum,0,TemporalMomentum);
-      TemporalMomentum = Compute_Macro(&Momentum_1.vector, Positions, 1, "top"); 
-      gsl_vector_set(MacroMomentum,1,TemporalMomentum);
-      TemporalMomentum = Compute_Macro(&Momentum_2.vector, Positions, 1, "top"); 
-      gsl_vector_set(MacroMomentum,2,TemporalMomentum);
-      
-      PrintInfo(Step, MacroMomentum, oFile.MacroMomentumUpperWall);
-    
-      PrintMsg("Computing the momentum of lower wall");
+    #if __COMPUTE_POD__
+      Compute_POD(&Pod, MesoDensity_2, MesoMomentum, MesoEnergy, MesoKinetic);
+    #endif
 
-      TemporalMomentum = Compute_Macro(&Momentum_0.vector, Positions, 1, "bottom"); 
-      gsl_vector_set(MacroMomentum,0,TemporalMomentum);
-      TemporalMomentum = Compute_Macro(&Momentum_1.vector, Positions, 1, "bottom"); 
-      gsl_vector_set(MacroMomentum,1,TemporalMomentum);
-      TemporalMomentum = Compute_Macro(&Momentum_2.vector, Positions, 1, "bottom"); 
-      gsl_vector_set(MacroMomentum,2,TemporalMomentum);
+    #if __COMPUTE_MULTIPLE_TAU__
+      PrintMsg("Correlating displacements and velocities (multiple tau)...");
+      Compute_MultipleTau(&MTau, Positions, Velocities, &Types, &Order, z);
+    #endif
 
-      PrintInfo(Step, MacroMomentum, oFile.MacroMomentumLowerWall);
-    
-      gsl_vector_free(MacroMomentum);
+    #if __COMPUTE_LAYER_SK__
+      PrintMsg("Obtaining the structure factor of the layers...");
+      Compute_LayerSk(&Sk, Positions, &Types, z);
     #endif
+    
+    // MACROSCOPIC INFORMATION
 
-    #if __COMPUTE_CENTER_OF_MASS__
-      gsl_vector * CenterOfMass = gsl_vector_calloc(4);
-      
-      PrintMsg("Computing Center of Mass upper wall");
-      Compute_CenterOfMass(Positions, 1, "top", CenterOfMass);
-      PrintInfo(Step, CenterOfMass, oFile.CenterOfMassUpperWall);
-      
-      PrintMsg("Computing Center of Mass lower wall");
-      Compute_CenterOfMass(Positions, 1, "bottom", CenterOfMass);
-      PrintInfo(Step, CenterOfMass, oFile.CenterOfMassLowerWall);
-      
-      gsl_vector_free(CenterOfMass);
+    #if __COMPUTE_MACRO__
+      PrintMsg("Computing the energy, momentum and center of mass of the groups");
+      Compute_Groups(Positions, &Types, &Order, &Groups);
+      Compute_Macro(Positions, Energy, Momentum, Cross, &Groups);
+      PrintMacro(Step, &Groups);
     #endif
   }
  
@@ -762,19 +997,26 @@ int main (int argc, char *argv[]) {
   fclose(oFile.MesoInternalEnergy);
   #endif
 
-  #if __COMPUTE_MACRO_ENERGY__
-  fclose(oFile.MacroEnergyUpperWall);
-  fclose(oFile.MacroEnergyLowerWall);
+  #if __COMPUTE_MOP__
+  fclose(oFile.MesoMOP1_0);
+  fclose(oFile.MesoMOP1_1);
+  fclose(oFile.MesoMOP1_2);
+  fclose(oFile.MesoMOP2_0);
+  fclose(oFile.MesoMOP2_1);
+  fclose(oFile.MesoMOP2_2);
   #endif
-  
-  #if __COMPUTE_MACRO_MOMENTUM__
-  fclose(oFile.MacroMomentumUpperWall);
-  fclose(oFile.MacroMomentumLowerWall);
+
+  #if __COMPUTE_HEAT_FLUX__
+  fclose(oFile.MesoHeat1_0);
+  fclose(oFile.MesoHeat1_1);
+  fclose(oFile.MesoHeat1_2);
+  fclose(oFile.MesoHeat2_0);
+  fclose(oFile.MesoHeat2_1);
+  fclose(oFile.MesoHeat2_2);
   #endif
-  
-  #if __COMPUTE_CENTER_OF_MASS__
-  fclose(oFile.CenterOfMassUpperWall);
-  fclose(oFile.CenterOfMassLowerWall);
+
+  #if __COMPUTE_MACRO__
+  FreeGroups(&Groups);
   #endif
 
   // SECOND COMPUTATION. OBTAIN MEAN VALUES
@@ -928,19 +1170,152 @@ int main (int argc, char *argv[]) {
 
       gsl_vector_free(MesoAverage);
     }
+    #if __COMPUTE_MOP__
+    #pragma omp section
+    {
+      gsl_vector * MesoAverage  = gsl_vector_calloc(NNodes);
+      gsl_vector * MesoAverage2 = gsl_vector_calloc(NNodes);
+      char * Component[3] = {"xz", "yz", "zz"};
+      char   File[40], AvgFile[40];
+
+      // The kinetic part of the first snapshot is zero (no crossings are known),
+      // so its average is over the NSteps-1 remaining snapshots. The total is
+      // only saved as an average
+      for (int a=0;a<3;a++)
+      {
+        sprintf(File,    ".MesoMOP1_%s.dat",     Component[a]);
+        sprintf(AvgFile, ".MesoMOP1_%s.avg.dat", Component[a]);
+        Compute_Mean_Values(filestr, File,           MesoAverage);
+        if (NSteps > 1)
+          gsl_vector_scale(MesoAverage, NSteps/(NSteps-1.0));
+        SaveVectorWithIndex(filestr, AvgFile,     z, MesoAverage);
+
+        sprintf(File,    ".MesoMOP2_%s.dat",     Component[a]);
+        sprintf(AvgFile, ".MesoMOP2_%s.avg.dat", Component[a]);
+        Compute_Mean_Values(filestr, File,           MesoAverage2);
+        SaveVectorWithIndex(filestr, AvgFile,     z, MesoAverage2);
+
+        sprintf(AvgFile, ".MesoMOP_%s.avg.dat",  Component[a]);
+        gsl_vector_add(MesoAverage, MesoAverage2);
+        SaveVectorWithIndex(filestr, AvgFile,     z, MesoAverage);
+      }
+
+      gsl_vector_free(MesoAverage);
+      gsl_vector_free(MesoAverage2);
+    }
+    #endif
+    #if __COMPUTE_HEAT_FLUX__
+    #pragma omp section
+    {
+      gsl_vector * MesoAverage  = gsl_vector_calloc(NNodes);
+      gsl_vector * MesoAverage2 = gsl_vector_calloc(NNodes);
+      char * Component[3] = {"x", "y", "z"};
+      char   File[40], AvgFile[40];
+
+      for (int a=0;a<3;a++)
+      {
+        sprintf(File,    ".MesoHeat1_%s.dat",     Component[a]);
+        sprintf(AvgFile, ".MesoHeat1_%s.avg.dat", Component[a]);
+        Compute_Mean_Values(filestr, File,           MesoAverage);
+        SaveVectorWithIndex(filestr, AvgFile,     z, MesoAverage);
+
+        sprintf(File,    ".MesoHeat2_%s.dat",     Component[a]);
+        sprintf(AvgFile, ".MesoHeat2_%s.avg.dat", Component[a]);
+        Compute_Mean_Values(filestr, File,           MesoAverage2);
+        SaveVectorWithIndex(filestr, AvgFile,     z, MesoAverage2);
+
+        sprintf(AvgFile, ".MesoHeat_%s.avg.dat",  Component[a]);
+        gsl_vector_add(MesoAverage, MesoAverage2);
+        SaveVectorWithIndex(filestr, AvgFile,     z, MesoAverage);
+      }
+
+      gsl_vector_free(MesoAverage);
+      gsl_vector_free(MesoAverage2);
+    }
+    #endif
   }
+
+  #if __MESO_GRID__
+    PrintMsg("Saving the averages of the meso grid...");
+    SaveMesoGrid(filestr, z, &Mesh);
+  #endif
+
+  #if __COMPUTE_CORRELATIONS__
+    PrintMsg("Computing the time correlations of the meso fields...");
+    SaveCorrelations(filestr, &Corr);
+  #endif
+
+  #if __COMPUTE_COVARIANCE__
+    PrintMsg("Computing the covariance matrices of the meso fields...");
+    SaveCovariance(filestr, &Cov);
+  #endif
+
+  #if __COMPUTE_POD__
+    PrintMsg("Saving the POD modes of the meso fields...");
+    SavePOD(filestr, &Pod);
+  #endif
+
+  #if __COMPUTE_MULTIPLE_TAU__
+    PrintMsg("Saving the mean squared displacements and velocity autocorrelations...");
+    SaveMultipleTau(filestr, &MTau);
+  #endif
+
+  #if __COMPUTE_LAYER_SK__
+    PrintMsg("Saving the structure factor of the layers...");
+    SaveLayerSk(filestr, &Sk);
+  #endif
+
+  #if __COMPUTE_RDF__
+    PrintMsg("Saving the radial distribution functions...");
+    SaveRDF(filestr, &Rdf, &Types);
+  #endif
   // END OF BLOCK. COMPUTATION DONE
 
   // BEGIN OF BLOCK. FREE MEM
   
+  FreePairTable();
+  FreeNodeLattice();
+
   // Free micro vectors and matrices
   gsl_matrix_free(Force);
   gsl_vector_free(Energy);
   gsl_vector_free(Kinetic);
+  if (Cross != NULL)
+    gsl_matrix_free(Cross);
   
   // gsl_vector_free(zPart);
   gsl_vector_free(z);
 
+  free(Types.Index);
+  free(Order.Id);
+  free(Order.Row);
+  #if __WALL_GRID__
+    FreeWallGrid(&Grid);
+  #endif
+  #if __CLUSTER_PAIRS__ || __BENCHMARK_FORCES__
+    FreeClusterList(&Clusters);
+  #endif
+  #if __MESO_GRID__
+    FreeMesoGrid(&Mesh);
+  #endif
+  #if __COMPUTE_CORRELATIONS__
+    FreeCorrelations(&Corr);
+  #endif
+  #if __COMPUTE_COVARIANCE__
+    FreeCovariance(&Cov);
+  #endif
+  #if __COMPUTE_POD__
+    FreePOD(&Pod);
+  #endif
+  #if __COMPUTE_MULTIPLE_TAU__
+    FreeMultipleTau(&MTau);
+  #endif
+  #if __COMPUTE_LAYER_SK__
+    FreeLayerSk(&Sk);
+  #endif
+  #if __COMPUTE_RDF__
+    FreeRDF(&Rdf);
+  #endif
   gsl_vector_free(List);
   gsl_vector_free(ListHead);
   gsl_matrix_free(Neighbors);
@@ -967,6 +1342,15 @@ int main (int argc, char *argv[]) {
   gsl_matrix_free(MesoVelocity);
   gsl_vector_free(MesoInternalEnergy);
 
+  gsl_matrix_free(MesoMOP1);
+  gsl_matrix_free(MesoMOP2);
+  #if __COMPUTE_MOP__
+    gsl_matrix_free(MOPPrevious);
+  #endif
+
+  gsl_matrix_free(MesoHeat1);
+  gsl_matrix_free(MesoHeat2);
+
   // END OF BLOCK. MEM FREE
   
   PrintMsg("EOF. Have a nice day.");
@@ -12,9 +12,15 @@
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_mode.h>
 #include <gsl/gsl_errno.h>
+#include <gsl/gsl_eigen.h>
+#include <gsl/gsl_fft_complex.h>
+#include <gsl/gsl_fft_real.h>
+#include <gsl/gsl_fft_halfcomplex.h>
 #include <gsl/gsl_blas.h>
 #include <gsl/gsl_linalg.h>
 #include <gsl/gsl_matrix.h>
+#include <gsl/gsl_spline.h>
+#include <gsl/gsl_sort_vector.h>
 #include <gsl/gsl_vector.h>
 #include <sys/stat.h>
 
@@ -28,6 +34,53 @@
 #  Microscopic functions 
 ############################################################################# */
 
+// Per-type index lists. Index stores the particle indices sorted by type, so
+// that the particles of type t are Index[First[t]] ... Index[Last[t]-1].  Type
+// 0 refers to all the particles (First[0] = 0, Last[0] = NParticles).
+//
+// Kernels that only deal with one kind of atom (e.g. the fluid) should iterate
+// over its range instead of testing the type of every particle.
+//
+// The wall types (WallTypes in params.h) are stored first and the fluid types
+// last, so WallType and FluidType are two more ranges that span all the wall
+// and all the fluid particles. Kernels that take a type also take them.
+
+#define WallType    (NTypes+1)
+#define FluidType   (NTypes+2)
+
+struct TypeList
+{
+  int * Index;
+  int   First[NTypes+3];
+  int   Last[NTypes+3];
+};
+
+// Build the per-type index lists from the first column of Positions
+
+void Compute_TypeList (gsl_matrix * Positions, struct TypeList * Types);
+
+// Spatial ordering of the particles. Particles are stored in memory following
+// a Morton  (Z-order)  curve,  so that particles close in space are also close
+// in memory.  Id[i]  is the row in the input files of the particle stored in
+// row i, and Row[id] is the row in which particle id of the input files is
+// stored (the inverse permutation). Without reordering, both are the identity.
+
+struct Ordering
+{
+  int * Id;
+  int * Row;
+};
+
+void Compute_Identity_Order (struct Ordering * Order);
+
+// Obtain the Morton order of the particles in Positions (input file order)
+
+void Compute_Spatial_Order (gsl_matrix * Positions, struct Ordering * Order);
+
+// Permute the rows of Matrix from the input file order to the spatial order
+
+void Apply_Order (struct Ordering * Order, gsl_matrix * Matrix);
+
 //  Compute the  force that  particle j  (type2) exerts  on particle  i (type1).
 // This function only computes the force  if particle j is of type2 and particle
 // i is of type1.  It will compute  the force between all the particles if type1
@@ -39,11 +92,180 @@
 double Compute_Force_ij (gsl_matrix * Positions, int i, int j, int type1, 
                          int type2, double * fij);
 
+// Tabulated force and energy that the (rigid) wall exerts on a fluid particle.
+// Table stores fx, fy, fz  and the energy at each node of a periodic grid (one
+// grid per fluid type, fluid type t uses grid Slot[t]), and
+// Reference the wall configuration used to build it,  indexed  by the row of
+// each particle in the input files (see wallgrid.c)
+
+struct WallGrid
+{
+  int          Nx, Ny, Nz;
+  double       dx, dy, dz;
+  int          NFluid;
+  int          Slot[NTypes+1];
+  double     * Table;
+  gsl_matrix * Reference;
+};
+
+// Radial distribution functions (in rdf.c), by pair of types and element of
+// the central atom. Local keeps a histogram (Size values) per thread: the pairs
+// of (a,b) in bins of width dr,  and the number of central atoms
+
+struct RDF
+{
+  gsl_vector * z;
+  double       dr;
+  int          NThreads;
+  int          Size;
+  double     * Local;
+};
+
+void AllocRDF (struct RDF * Rdf, gsl_vector * z);
+
+void FreeRDF (struct RDF * Rdf);
+
+// 1 if the atoms of type t are central atoms (see RdfCenters)
+
+int RDF_IsCenter (int t);
+
+// Count atom i as a central atom in the histogram of this thread, and return
+// the histogram of its type and element for RDF_Add
+
+double * RDF_Center (struct RDF * Rdf, gsl_matrix * Positions, int i);
+
+void RDF_Add (struct RDF * Rdf, double * Hist, gsl_matrix * Positions, int i,
+              int j);
+
+// Separate sweep over the central atoms that are not of type Done (those
+// already histogrammed by the force loop; 0: all, -1: none)
+
+void Compute_RDF (gsl_matrix * Positions, gsl_matrix * Neighbors,
+                  gsl_vector * ListHead, gsl_vector * List,
+                  struct TypeList * Types, int Done, struct RDF * Rdf);
+
+// One file per pair of types (a,b), one row per bin of r with g_ab(r) of each
+// element
+
+void SaveRDF (char * basename, struct RDF * Rdf, struct TypeList * Types);
+
+// Only type1 particles are visited.  If Grid is not NULL, the force and energy
+// that type2 particles exert on them are interpolated from Grid instead of
+// computed pair by pair. If Rdf is not NULL, the pairs of the visited particles
+// that are central atoms (RDF_IsCenter) are added to its histograms.
+
 void Compute_Forces (gsl_matrix * Positions, gsl_matrix * Velocities, 
                      gsl_matrix * Neighbors, gsl_vector * ListHead, 
-                     gsl_vector * List, int type1, int type2, 
-                     gsl_matrix * Forces, gsl_vector * Energy,
-                     gsl_vector * Kinetic);
+                     gsl_vector * List, struct TypeList * Types, 
+                     int type1, int type2, struct WallGrid * Grid,
+                     struct RDF * Rdf, gsl_matrix * Forces, 
+                     gsl_vector * Energy, gsl_vector * Kinetic);
+
+// Separate sweep over the particles that are not of type1 (the walls), for all
+// the engines. It sets their kinetic and potential energies (the latter with
+// all their pairs with __COMPUTE_MACRO_ENERGY__, only those with type1 particles
+// otherwise). If Cross (NParticles x 4) is not NULL,  row i of Cross is the
+// force and energy (fx fy fz e) that the type1 particles exert on particle i
+// (0 for the type1 particles)
+
+void Compute_Walls (gsl_matrix * Positions, gsl_matrix * Velocities,
+                    gsl_matrix * Neighbors, gsl_vector * ListHead,
+                    gsl_vector * List, struct TypeList * Types, int type1,
+                    gsl_matrix * Cross, gsl_vector * Energy, gsl_vector * Kinetic);
+
+// Domain decomposition (in domain.c). The cells are split in NDomains ranges
+// of contiguous cells (z-slabs) with the same estimated cost.  DomainFirst[d]
+// is the first cell of domain d.  Returns the estimated load imbalance (cost
+// of the most expensive domain over the average)
+
+double Compute_Domains (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                        gsl_vector * ListHead, gsl_vector * List, int type1, 
+                        int NDomains, int * DomainFirst);
+
+// Same as Compute_Forces, with as many domains as threads. Each domain copies
+// its cells and their halo into a private buffer. Returns the estimated
+// imbalance
+
+double Compute_Forces_Domain (gsl_matrix * Positions, gsl_matrix * Velocities, 
+                              gsl_matrix * Neighbors, gsl_vector * ListHead, 
+                              gsl_vector * List, int type1, int type2, 
+                              struct WallGrid * Grid, gsl_matrix * Forces, 
+                              gsl_vector * Energy, gsl_vector * Kinetic);
+
+// Floating point type of the particle data packed by the cluster-pair and the
+// domain engines.  With  __SINGLE_PRECISION__  positions and pair distances are
+// float, while forces, energies and every reduction are accumulated in double
+
+#if __SINGLE_PRECISION__ && !(__CLUSTER_PAIRS__ || __DOMAIN_DECOMPOSITION__)
+  #error "__SINGLE_PRECISION__ needs __CLUSTER_PAIRS__ or __DOMAIN_DECOMPOSITION__"
+#endif
+
+#if __SINGLE_PRECISION__
+  typedef float real;
+#else
+  typedef double real;
+#endif
+
+// Validation of __SINGLE_PRECISION__ (in precision.c). Forces and Energy are
+// the result of the single precision engine.  They are compared with those of
+// Compute_Forces, and the largest relative deviation of the particle forces
+// and of the MesoForce, MesoEnergy and (with __COMPUTE_HEAT_FLUX__) MesoHeat1
+// profiles is printed. The stresses, MesoHeat2 and the method of planes use
+// Compute_Force_ij in double and do not depend on the engine
+
+void Check_Precision (gsl_matrix * Positions, gsl_matrix * Velocities, 
+                      gsl_matrix * Neighbors, gsl_vector * ListHead, 
+                      gsl_vector * List, struct TypeList * Types, gsl_vector * z,
+                      int type1, int type2, struct WallGrid * Grid,
+                      gsl_matrix * Forces, gsl_vector * Energy);
+
+// Cluster-pair engine (in clusters.c). Particles are grouped in clusters of
+// ClusterSize particles of the same cell,  stored as  x, y, z and Type arrays
+// (Atom is the row in Positions, -1 for padding). The pairs of clusters whose
+// bounding boxes are within Rcut are stored in Pair[PairFirst[c] ...
+// PairFirst[c+1]-1], together with the periodic Shift of the j-cluster.
+
+struct ClusterList
+{
+  int      NClusters, MaxClusters, MaxPairs;
+  int    * Atom;
+  int    * Type;
+  real   * x, * y, * z;
+  double * Center, * Half;
+  int    * CellFirst;
+  int    * PairFirst;
+  int    * Pair;
+  double * Shift;
+};
+
+void AllocClusterList (struct ClusterList * Clusters);
+
+void FreeClusterList (struct ClusterList * Clusters);
+
+void Compute_ClusterList (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                          gsl_vector * ListHead, gsl_vector * List, 
+                          struct ClusterList * Clusters);
+
+// Same as Compute_Forces (same Forces, Energy and Kinetic), using the cluster
+// pairs instead of per-particle Verlet lists
+
+void Compute_Forces_Cluster (gsl_matrix * Velocities, struct ClusterList * Clusters,
+                             int type1, int type2, struct WallGrid * Grid,
+                             gsl_matrix * Forces, gsl_vector * Energy, 
+                             gsl_vector * Kinetic);
+
+// Fraction of the particle pairs inside the cluster pairs that are within Rcut
+
+double ClusterPairEfficiency (struct ClusterList * Clusters);
+
+// Benchmark: run both engines on the current snapshot, report their timings
+// and the largest difference between them
+
+void Check_ClusterForces (gsl_matrix * Positions, gsl_matrix * Velocities, 
+                          gsl_matrix * Neighbors, gsl_vector * ListHead, 
+                          gsl_vector * List, struct TypeList * Types,
+                          struct ClusterList * Clusters, int type1, int type2,
+                          struct WallGrid * Grid);
 
 // Some atoms are  outside the simulation box.  We use PBC to  put them into the
 // box
@@ -63,6 +285,115 @@ void Compute_Velocity_Module (gsl_matrix * Velocities, gsl_vector * Vmod);
 void Compute_Momentum(gsl_matrix * Positions, gsl_matrix * Velocities, 
                       gsl_matrix * Momentum);
 
+/* #############################################################################
+#  NUMA aware allocation and thread placement (in numa.c)
+############################################################################# */
+
+// Same as malloc and gsl_*_calloc, but the memory is zeroed in parallel (one
+// block per thread), so each block is placed in the NUMA node of its thread.
+// The pages are spread over the nodes, but only the loops with a static
+// schedule over the rows read local memory (see numa.c)
+
+void * AllocArray (size_t n, size_t size);
+
+gsl_matrix * AllocMatrix (size_t n1, size_t n2);
+
+gsl_vector * AllocVector (size_t n);
+
+// Read the NUMA topology (the cpus allowed to the process only), pin the
+// threads following ThreadPlacement (unless OMP_PROC_BIND or OMP_PLACES are
+// set, or there are less allowed cpus than threads) and print a report
+
+void Setup_Threads (void);
+
+/* #############################################################################
+#  Pair styles (in pair.c) 
+############################################################################# */
+
+// A pair style returns the  energy of a pair at squared distance r2 and stores
+// in ff the force divided by r,  so  that the force on i is ff * (ri - rj).  The
+// cut-off is applied by the caller.
+
+struct PairParameters;
+
+typedef double (*PairStyle) (const struct PairParameters * pair, double r2, 
+                             double * ff);
+
+// Parameters of a pair of types. LJ pairs use epsilon, sigma2 and ecut.
+// Tabulated pairs use a cubic spline in r^2  with n intervals of width  1/ids
+// starting at s0. Spline stores 8 coefficients per interval: 4 for the energy
+// and 4 for the force divided by r.
+
+struct PairParameters
+{
+  PairStyle Style;
+  double    rcut2;
+  double    epsilon;
+  double    sigma2;
+  double    ecut;
+  double    s0;
+  double    ids;
+  int       n;
+  double  * Spline;
+};
+
+// Flat tables of pair parameters and masses, built once by Compute_PairTable
+// from the per-type parameters, the mixing rule, PairCoeffs and PairTables (see
+// params.h). The entry of (type1,type2) is PairTable[type1*(NTypes+1)+type2].
+// Row and column 0 are zero, so that type 0 particles do not interact.
+// TypeClass[t] is FluidType or WallType for the types in FluidTypes and
+// WallTypes (-1 otherwise).
+
+extern struct PairParameters PairTable[(NTypes+1)*(NTypes+1)];
+extern double MassTable[NTypes+1];
+extern int    TypeClass[NTypes+1];
+
+// 1 if every pair is LJ (set by Compute_PairTable)
+
+extern int    AllPairsLJ;
+
+// 1 if an atom of type t is of the given type (a type, FluidType or WallType)
+
+#define IsOfType(t, type) (((t) == (type)) || (TypeClass[(t)] == (type)))
+
+void Compute_PairTable (void);
+
+void FreePairTable (void);
+
+// Shifted LJ. LJ_Pair is the same kernel, inlined by the force loops
+
+double Pair_LJ (const struct PairParameters * pair, double r2, double * ff);
+
+static inline double LJ_Pair(const struct PairParameters * pair, double r2, double * ff)
+{
+  double r2inv = 1.0/r2;
+  double r2i   = pair->sigma2*r2inv;
+  double r6i   = r2i*r2i*r2i;
+
+  *ff = 48.0*pair->epsilon*r2inv*r6i*(r6i-0.5);
+
+  // In lammps, pair_modify shift yes implies the existence of an ecut
+  return 4.0*pair->epsilon*r6i*(r6i-1.0)-pair->ecut;
+}
+
+// Energy and force over r of any pair. With AllPairsLJ (the usual case) the
+// test is the same for every pair, and LJ is inlined instead of called
+// through Style
+
+static inline double Eval_Pair(const struct PairParameters * pair, double r2, double * ff)
+{
+  return AllPairsLJ ? LJ_Pair(pair, r2, ff) : pair->Style(pair, r2, ff);
+}
+
+// Tabulated potential
+
+double Pair_Table (const struct PairParameters * pair, double r2, double * ff);
+
+// Read  the section Keyword of a  lammps  pair_style table file  and build the
+// spline of pair. Returns the outer cut-off of the table
+
+double Read_PairTable (char * File, char * Keyword, struct PairParameters * pair);
+
 /* #############################################################################
 #  Auxiliary functions that appear in aux.c 
 ############################################################################# */
@@ -122,6 +453,37 @@ int Compute_VerletList (gsl_matrix * Micro, int TestParticle,
                         gsl_vector * LinkedHead, gsl_vector * LinkedList, 
                         int * Verlet);
 
+/* #############################################################################
+#  Wall grid functions (in wallgrid.c) 
+############################################################################# */
+
+// Tabulate the force and energy that the wall particles exert on a particle of
+// each fluid type on a WallGridNx x WallGridNy x WallGridNz grid
+
+void Compute_WallGrid (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                       gsl_vector * ListHead, gsl_vector * List, 
+                       struct TypeList * Types, struct Ordering * Order,
+                       struct WallGrid * Grid);
+
+// Interpolate the force (f) and return the energy at (x,y,z) of a particle of
+// the given fluid type
+
+double InterpolateWallGrid (struct WallGrid * Grid, int type, double x, 
+                            double y, double z, double * f);
+
+// Maximum displacement of the wall particles from the reference configuration
+
+double Compute_WallGrid_Drift (gsl_matrix * Positions, struct TypeList * Types,
+                               struct Ordering * Order, struct WallGrid * Grid);
+
+// Print the maximum error of the interpolated wall force for all fluid particles
+
+void Check_WallGrid (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                     gsl_vector * ListHead, gsl_vector * List, 
+                     struct TypeList * Types, struct WallGrid * Grid);
+
+void FreeWallGrid (struct WallGrid * Grid);
+
 /* #############################################################################
 #  IO functions that appears in io.c 
 ############################################################################# */
@@ -206,12 +568,18 @@ struct OutputFiles
   FILE * MesoVelocity_1;
   FILE * MesoVelocity_2;
   FILE * MesoInternalEnergy;
-  FILE * MacroEnergyUpperWall;
-  FILE * MacroEnergyLowerWall;
-  FILE * MacroMomentumUpperWall;
-  FILE * MacroMomentumLowerWall;
-  FILE * CenterOfMassUpperWall;
-  FILE * CenterOfMassLowerWall;
+  FILE * MesoMOP1_0;
+  FILE * MesoMOP1_1;
+  FILE * MesoMOP1_2;
+  FILE * MesoMOP2_0;
+  FILE * MesoMOP2_1;
+  FILE * MesoMOP2_2;
+  FILE * MesoHeat1_0;
+  FILE * MesoHeat1_1;
+  FILE * MesoHeat1_2;
+  FILE * MesoHeat2_0;
+  FILE * MesoHeat2_1;
+  FILE * MesoHeat2_2;
 };
 
 // Print  a row in  *fileptr with the  information stored in  vector.  The first
@@ -240,13 +608,120 @@ void PrintComputingOptions(void);
 #  Mesoscopic functions in functions.c 
 ############################################################################# */
 
+// Node lattice. Nodes z[0] < ... < z[NNodes-1] = Lz (the periodic image of
+// z = 0).  Node mu has a shape function of degree NodeBasis (see basis.c), and
+// element mu spans from node mu to node mu+1 (the last one from 0 to z[0]).
+// h[mu] is the width of the element at the left of node mu and Volume[mu] is
+// Lx Ly times the integral of its shape function.  Lookup maps NLookup bins of
+// width 1/iDelta (not wider than any element) to the first node above them
+
+struct NodeLattice
+{
+  double   h[NNodes];
+  double   Volume[NNodes];
+  int      NLookup;
+  double   iDelta;
+  int    * Lookup;
+};
+
+extern struct NodeLattice Lattice;
+
+// Fill z (from NodeFile or NodeStretch) and build Lattice
+
 void Compute_Node_Positions (gsl_vector * z);
 
+void FreeNodeLattice (void);
+
+// Node at the right of zi (NNodes if zi = Lz) in O(1)
+
+int Node_Right (gsl_vector * z, double zi);
+
+// Linear weights of zi in its two nodes. Returns the right node
+
+int Node_Weights (gsl_vector * z, double zi, int * muLeft, double * wLeft, 
+                  double * wRight);
+
+// Element to which zi belongs, and its volume
+
+int Element_Of (gsl_vector * z, double zi);
+
+double Element_Volume (int mu);
+
+/* #############################################################################
+#  Shape functions of the nodes (in basis.c)
+############################################################################# */
+
+// Number of nodes in the support of a particle (NodeBasis+1) and number of
+// particles whose weights are computed at once
+
+#define BasisSupport (NodeBasis+1)
+#define BasisChunk   64
+
+// Node coordinate of zi: u = mu + (zi - z_mu)/h along element mu
+
+double Basis_Coordinate (gsl_vector * z, double zi);
+
+// Weights w[0 ... BasisSupport-1] of zi in the nodes First, First+1, ...
+// (mod NNodes). Returns First
+
+int Basis_Weights (gsl_vector * z, double zi, double * w);
+
+// Same for n <= BasisChunk particles at once. The weight s of particle k is
+// stored in W[s*BasisChunk+k]
+
+void Basis_Weights_Block (gsl_vector * z, int n, const double * zi, int * First,
+                          double * W);
+
+// Meso[mu*MesoStride] += Micro[i*Stride] w_mu(z_i) for the n particles in Index
+// (0 ... n-1 if Index is NULL). Micro = NULL adds the weights only
+
+void Basis_Scatter (gsl_matrix * Positions, const int * Index, int n, 
+                    gsl_vector * z, const double * Micro, size_t Stride, 
+                    double * Meso, size_t MesoStride);
+
+// Lattice.Volume[mu]: Lx Ly times the integral of the shape function of mu
+
+void Compute_Basis_Volumes (void);
+
+// Mass matrix  M[mu][nu] = Lx Ly  int phi_mu phi_nu dz,  stored as its Cholesky
+// factor L (n x n,  row major).  Row i of L is nonzero from column First[i] to
+// i. NodeMass is the mass matrix of the node lattice (with __MASS_MATRIX__)
+
+struct MassMatrix
+{
+  int      n;
+  int    * First;
+  double * L;
+};
+
+extern struct MassMatrix NodeMass;
+
+// Factor the n x n matrix A (row major)
+
+void Factor_MassMatrix (struct MassMatrix * M, int n, const double * A);
+
+// Overwrite b (b[i*Stride]) with the solution of M x = b
+
+void Solve_MassMatrix (struct MassMatrix * M, double * b, size_t Stride);
+
+void FreeMassMatrix (struct MassMatrix * M);
+
+void Compute_Basis_MassMatrix (void);
+
+// Mass matrix of linear elements of width d on a periodic regular lattice
+
+void Compute_Hat_MassMatrix (struct MassMatrix * M, int n, double d);
+
+// Nodal values from the weighted sums b_mu = sum_i a_i phi_mu(z_i): solve with
+// the mass matrix (__MASS_MATRIX__), or divide by the node volumes (lumped)
+
+void Basis_Normalize (double * Meso, size_t Stride);
+
 void Compute_Meso_Energy (gsl_matrix * Micro, gsl_vector * MicroEnergy, 
                           gsl_vector * z, gsl_vector * MesoEnergy);
 
-void Compute_Meso_Density (gsl_matrix * Positions, gsl_vector * z, 
-                           int type, gsl_vector * MesoDensity);
+void Compute_Meso_Density (gsl_matrix * Positions, struct TypeList * Types,
+                           gsl_vector * z, int type, gsl_vector * MesoDensity);
 
 void Compute_Meso_Force (gsl_matrix * Positions, gsl_matrix * Forces, 
                          gsl_vector * n, gsl_matrix * MesoForce);
@@ -255,31 +730,373 @@ void Compute_Meso_Temp (gsl_vector * MesoKinetic, gsl_vector * MesoDensity,
                         gsl_vector * MesoTemp);
 
 void Compute_Meso_Sigma1 (gsl_matrix * Positions, gsl_matrix * Velocities,
-                          gsl_matrix * MesoSigma1);
+                          struct TypeList * Types, gsl_matrix * MesoSigma1,
+                          gsl_vector * z);
+
+// Kinetic stress and temperature of the fluid relative to the local streaming
+// velocity, from the moments of the velocities (one pass over the particles).
+// The stress is binned by element as in Compute_Meso_Sigma1,  the temperature
+// uses the weights of the nodes. Either output may be NULL
+
+void Compute_Meso_Peculiar (gsl_matrix * Positions, gsl_matrix * Velocities,
+                            struct TypeList * Types, gsl_matrix * MesoSigma1,
+                            gsl_vector * MesoTemp, gsl_vector * z);
+
+// Heat flux (energy current) of the fluid, as the stress tensor: a convective
+// part (MesoHeat1) and a virial part (MesoHeat2), which is computed with the
+// virial stress if MesoHeat2 is not NULL. Columns are the x, y, z components
 
-void Compute_Meso_Sigma2 (gsl_matrix * Positions, gsl_matrix * Neighbors, 
-                          gsl_vector * ListHead,  gsl_vector * List, 
-                          gsl_matrix * MesoSigma2, gsl_vector * z);
+void Compute_Meso_HeatFlux1 (gsl_matrix * Positions, gsl_matrix * Velocities,
+                             struct TypeList * Types, gsl_vector * Energy,
+                             gsl_vector * Kinetic, gsl_matrix * MesoHeat1,
+                             gsl_vector * z);
+
+void Compute_Meso_Sigma2 (gsl_matrix * Positions, gsl_matrix * Velocities,
+                          gsl_matrix * Neighbors, gsl_vector * ListHead,
+                          gsl_vector * List, struct TypeList * Types,
+                          gsl_matrix * MesoSigma2, gsl_matrix * MesoHeat2,
+                          gsl_vector * z);
 
 void Compute_Mean_Values(char * basename, char * filename, gsl_vector * MeanValues);
         
 void Compute_Meso_Velocity(gsl_matrix * MesoMomentum, gsl_vector * MesoDensity_0,
                            gsl_matrix * MesoVelocity);
 
-void Compute_Meso_Profile(gsl_matrix * Positions, gsl_vector * Micro, gsl_vector * z,
-                          gsl_vector * Meso, int type);
+void Compute_Meso_Profile(gsl_matrix * Positions, struct TypeList * Types, 
+                          gsl_vector * Micro, gsl_vector * z, gsl_vector * Meso, 
+                          int type);
 
 void Compute_InternalEnergy(gsl_vector * MesoEnergy, gsl_matrix * MesoMomentum, 
                             gsl_vector * MesoDensity, gsl_vector * InternalEnergy);
 
 double zmuij(gsl_vector * z, int mu, double zi, double zj);
 
+// Split the bond from zi to zi + dz (dz unwrapped, |dz| < Lz/2) among the
+// elements it crosses.  Element[p] gets Fraction[p] of the bond (both arrays of
+// NNodes+1). Returns the number of pieces
+
+int Bond_Split (gsl_vector * z, double zi, double dz, int * Element, 
+                double * Fraction);
+
+// Compute_Meso_Sigma2 with zmuij over the elements between i and j (the
+// implementation before Bond_Split), and a benchmark of both (in bonds.c)
+
+void Compute_Meso_Sigma2_zmuij (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                                gsl_vector * ListHead,  gsl_vector * List, 
+                                struct TypeList * Types, gsl_matrix * MesoSigma2, 
+                                gsl_vector * z);
+
+void Check_Sigma2 (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                   gsl_vector * ListHead, gsl_vector * List, 
+                   struct TypeList * Types, gsl_vector * z);
+
+// Node planes crossed by the segment from zi to zi + dz (dz unwrapped, |dz| <
+// Lz). Node needs NNodes entries. Returns the number of planes
+
+int Bond_Planes (gsl_vector * z, double zi, double dz, int * Node);
+
+// Method of planes (in mop.c). Columns a = 0, 1, 2 of MesoMOP1 (kinetic) and
+// MesoMOP2 (configurational) are P_az at the plane of each node (fluid only)
+
+void Compute_Meso_MOP (gsl_matrix * Positions, gsl_matrix * Neighbors, 
+                       gsl_vector * ListHead, gsl_vector * List, 
+                       struct TypeList * Types, gsl_vector * z, 
+                       gsl_matrix * MesoMOP2);
+
+// The kinetic part needs the previous snapshot: Previous (NParticles x 4) is
+// read (if Step > 0) and then overwritten with this one
+
+void Compute_Meso_MOP_Kinetic (gsl_matrix * Positions, gsl_matrix * Velocities,
+                               struct TypeList * Types, struct Ordering * Order,
+                               gsl_vector * z, gsl_matrix * Previous, int Step,
+                               gsl_matrix * MesoMOP1);
+
+/* #############################################################################
+#  Two and three dimensional mesoscopic grids (in mesogrid.c)
+############################################################################# */
+
+// Tensor product of GridNx x GridNy regular nodes in x and y and the NNodes of
+// the lattice in z.  Node (ix,iy,mu) is stored in (mu*Ny + iy)*Nx + ix, and so
+// is cell (ix,iy,mu),  which spans over element mu in z.  The particles of the
+// fluid are bucketed by element (Particle[ElementFirst[mu] ...]). Momentum is
+// stored by components (Size values each) and the stresses as 9 values per cell
+// (00, 01, 02, 10, ...).  The *Avg fields accumulate NSamples snapshots
+
+struct MesoGrid
+{
+  int      Nx, Ny;
+  double   dx, dy;
+  long     Size;
+  int      MaxPieces;
+  int      NSamples;
+  int    * Particle;
+  int    * ElementFirst;
+  double * Density, * Momentum, * Energy, * Kinetic;
+  double * Sigma1, * Sigma2;
+  double * DensityAvg, * MomentumAvg, * EnergyAvg, * KineticAvg, * SigmaAvg;
+  struct MassMatrix MassX, MassY;
+};
+
+void AllocMesoGrid (struct MesoGrid * Grid);
+
+void FreeMesoGrid (struct MesoGrid * Grid);
+
+// Bucket the particles of a given type by z element: the particles of element
+// mu are Particle[ElementFirst[mu]] ... Particle[ElementFirst[mu+1]-1]
+
+void Compute_Element_Bins (gsl_matrix * Positions, struct TypeList * Types,
+                           int type, gsl_vector * z, int * Particle,
+                           int * ElementFirst);
+
+// Same as Compute_Meso_Profile on the grid (density if Micro is NULL)
+
+void Compute_MesoGrid_Profile (gsl_matrix * Positions, gsl_vector * Micro,
+                               gsl_vector * z, struct MesoGrid * Grid,
+                               double * Field);
+
+// Kinetic and virial stresses of the cells. Bonds are split at the planes of
+// the grid, each piece contributing to the cell that contains it
+
+void Compute_MesoGrid_Sigma1 (gsl_matrix * Positions, gsl_matrix * Velocities,
+                              struct MesoGrid * Grid);
+
+void Compute_MesoGrid_Sigma2 (gsl_matrix * Positions, gsl_matrix * Neighbors,
+                              gsl_vector * ListHead, gsl_vector * List,
+                              gsl_vector * z, struct MesoGrid * Grid, int type);
+
+// All the fields of a snapshot (for particles of a given type), added to the
+// time averages
+
+void Compute_MesoGrid (gsl_matrix * Positions, gsl_matrix * Velocities,
+                       gsl_matrix * Momentum, gsl_vector * Energy,
+                       gsl_vector * Kinetic, gsl_matrix * Neighbors,
+                       gsl_vector * ListHead, gsl_vector * List,
+                       struct TypeList * Types, gsl_vector * z, int type,
+                       struct MesoGrid * Grid);
+
+// Save the time averages (basename.MesoGrid.avg.dat at the nodes and
+// basename.MesoGridSigma.avg.dat at the centers of the cells)
+
+void SaveMesoGrid (char * basename, gsl_vector * z, struct MesoGrid * Grid);
+
+/* #############################################################################
+#  Time correlations of the mesoscopic fields (in correlations.c)
+############################################################################# */
+
+// Series f*NNodes + mu is field f (CorrDensity ... CorrEnergy) at node mu.  The
+// last NBuffer frames of each series are kept in Buffer (N per series),  and
+// Raw accumulates sum_s A_mu(s+t) B_nu(s) for each pair of fields p at
+// ((p*NNodes + mu)*NNodes + nu)*CorrelationMaxLag + t. Head keeps the sums of
+// the first t frames and Tail the last CorrelationMaxLag frames (to subtract
+// the means at the end)
+
+#define NCorrFields 5
+
+struct Correlations
+{
+  int      NPairs;
+  int    * Pairs;
+  int      M, N;
+  int      NFrames, NBuffer;
+  double * Buffer;
+  double * Sum;
+  double * Head;
+  double * Tail;
+  double * Raw;
+};
+
+void AllocCorrelations (struct Correlations * Corr);
+
+void FreeCorrelations (struct Correlations * Corr);
+
+// Add a snapshot (the energy is MesoEnergy + MesoKinetic)
+
+void Compute_Correlations (struct Correlations * Corr, gsl_vector * MesoDensity,
+                           gsl_matrix * MesoMomentum, gsl_vector * MesoEnergy,
+                           gsl_vector * MesoKinetic);
+
+// C_mu,nu(t) = <dA_mu(t) dB_nu(0)> for each pair of fields.  One file per
+// pair, one row per lag with the NNodes x NNodes matrix (by rows of mu)
+
+void SaveCorrelations (char * basename, struct Correlations * Corr);
+
+// Equal time covariance <dA_mu dA_nu> of each field. Batch keeps the last
+// NBatch snapshots (columns, minus the first snapshot Shift),  XX the sum of
+// their outer products and Sum their sum
+
+struct Covariance
+{
+  int          NFrames, NBatch;
+  double     * Shift;
+  double     * Sum;
+  gsl_matrix * Batch[NCorrFields];
+  gsl_matrix * XX[NCorrFields];
+};
+
+void AllocCovariance (struct Covariance * Cov);
+
+void FreeCovariance (struct Covariance * Cov);
+
+void Compute_Covariance (struct Covariance * Cov, gsl_vector * MesoDensity,
+                         gsl_matrix * MesoMomentum, gsl_vector * MesoEnergy,
+                         gsl_vector * MesoKinetic);
+
+// The NNodes x NNodes covariance of each field and its eigenvalues (in
+// decreasing order)
+
+void SaveCovariance (char * basename, struct Covariance * Cov);
+
+// Streaming proper orthogonal decomposition of each field. Modes (by columns)
+// and Sigma are the leading Rank left singular vectors and values of the
+// centered snapshots,  Mean the mean of the snapshots in the basis and Block
+// the last NBlock snapshots (columns), not yet in the basis
+
+struct StreamingPOD
+{
+  int          NFrames, NBlock;
+  int          Rank[NCorrFields];
+  double     * Mean;
+  gsl_matrix * Block[NCorrFields];
+  gsl_matrix * Modes[NCorrFields];
+  gsl_vector * Sigma[NCorrFields];
+};
+
+void AllocPOD (struct StreamingPOD * Pod);
+
+void FreePOD (struct StreamingPOD * Pod);
+
+void Compute_POD (struct StreamingPOD * Pod, gsl_vector * MesoDensity,
+                  gsl_matrix * MesoMomentum, gsl_vector * MesoEnergy,
+                  gsl_vector * MesoKinetic);
+
+// The modes of each field (one row per node) and the spectrum (singular
+// values and variance of each mode)
+
+void SavePOD (char * basename, struct StreamingPOD * Pod);
+
+/* #############################################################################
+#  Multiple tau correlator (in multitau.c)
+############################################################################# */
+
+// Mean squared displacement (xy and z) and velocity autocorrelation (xy and z)
+// of the fluid, by element of the time origin. Slot maps the rows of the input
+// files to the atoms of the fluid.  D keeps MultipleTauP values of each level
+// for each atom (x y z vx vy vz), and A the block sums for the next level.
+// Image keeps the unwrapped and the last wrapped positions.  Sum and Count are
+// by quantity, level, lag and element
+
+#define MTQuantities 4
+
+struct MultipleTau
+{
+  int      NAtoms, NLevels, NFrames;
+  int    * Slot;
+  int    * Head;
+  int    * NValues;
+  int    * MCount;
+  double * D;
+  double * A;
+  double * Image;
+  double * Sum;
+  double * Count;
+};
+
+void AllocMultipleTau (struct MultipleTau * MT);
+
+void FreeMultipleTau (struct MultipleTau * MT);
+
+void Compute_MultipleTau (struct MultipleTau * MT, gsl_matrix * Positions,
+                          gsl_matrix * Velocities, struct TypeList * Types,
+                          struct Ordering * Order, gsl_vector * z);
+
+// One file per quantity, one row per lag (in snapshots) with the elements
+
+void SaveMultipleTau (char * basename, struct MultipleTau * MT);
+
+/* #############################################################################
+#  Structure factor of the layers (in structure.c)
+############################################################################# */
+
+// Sum and Count of S(k) by shell of |k| (width dk) and element.  Bin and Window
+// are the shell and 1/W(k)^2 of each mode of the grid. Particle and First are
+// the particles of the fluid by element
+
+struct LayerSk
+{
+  int      NFrames;
+  double   dk;
+  int    * Bin;
+  double * Window;
+  double * Sum;
+  double * Count;
+  int    * Particle;
+  int    * First;
+};
+
+void AllocLayerSk (struct LayerSk * Sk);
+
+void FreeLayerSk (struct LayerSk * Sk);
+
+void Compute_LayerSk (struct LayerSk * Sk, gsl_matrix * Positions,
+                      struct TypeList * Types, gsl_vector * z);
+
+// One row per shell: |k| and S(k) of each element
+
+void SaveLayerSk (char * basename, struct LayerSk * Sk);
+
 /* #############################################################################
 #  Macroscopic functions in macrofunctions.c 
 ############################################################################# */
 
-double Compute_Macro(gsl_vector * Micro, gsl_matrix * Positions, int type, char *str);
+// Groups of atoms  (AtomGroups in params.h).  A group selects the atoms of a
+// type (0: all types) with ZMin <= z < ZMax,  IdMin <= id < IdMax (the row in
+// the input files) and GroupRegion(g, x, y, z).
+
+struct AtomGroup
+{
+  char * Name;
+  int    Type;
+  double ZMin, ZMax;
+  int    IdMin, IdMax;
+};
+
+// The index lists are rebuilt every snapshot: the atoms of group g are Index
+// [First[g]] ... Index[First[g+1]-1]. Macro has MacroValues values per group:
+// energy, momentum (x y z), mass, the sum of the mass times the row of
+// Positions (type x y z), and from the interaction with the fluid the force,
+// the sum of r x f and the energy.  oFile keeps the MacroFiles files of each
+// group (NULL if not computed)
+
+#define MacroValues 16
+#define MacroFiles  6
+
+struct GroupList
+{
+  int                NGroups, Size;
+  struct AtomGroup * Group;
+  int              * First;
+  int              * Index;
+  double           * Macro;
+  FILE            ** oFile;
+};
+
+// Read AtomGroups and open ./output/basename.MacroEnergy<Name>.dat,
+// .MacroMomentum<Name>.dat,  .CenterOfMass<Name>.dat, and .MacroForce<Name>.dat,
+// .MacroTorque<Name>.dat and .MacroFluidEnergy<Name>.dat
+
+void AllocGroups (struct GroupList * Groups, char * basename);
+
+void FreeGroups (struct GroupList * Groups);
+
+void Compute_Groups (gsl_matrix * Positions, struct TypeList * Types,
+                     struct Ordering * Order, struct GroupList * Groups);
+
+// Energy, momentum and mass moments of every group,  and the force and energy
+// of the fluid on the group from Cross (see Compute_Forces) if not NULL
+
+void Compute_Macro (gsl_matrix * Positions, gsl_vector * Energy, gsl_matrix * Momentum,
+                    gsl_matrix * Cross, struct GroupList * Groups);
 
-void Compute_CenterOfMass(gsl_matrix * Positions, int type, char *str, gsl_vector * CenterOfMass);
+void PrintMacro (int Step, struct GroupList * Groups);
 
 #endif
@@ -0,0 +1,476 @@
+/*
+ * Filename   : clusters.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 14:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Cluster-pair nonbonded engine. Particles are grouped in
+ *              clusters of ClusterSize and the forces are evaluated in
+ *              ClusterSize x ClusterSize tiles
+ *
+ */
+
+#include "cg.h"
+
+// Clusters are built cell by cell: the particles of a cell are sorted in z and
+// split in groups of ClusterSize. The last cluster of a cell is padded with
+// type 0 entries (Atom = -1), which never interact.
+//
+// The cluster-pair list is a full list (i-j and j-i are both stored), so that
+// each i-cluster only writes its own particles and no reduction is needed.
+// Each pair stores the periodic shift of the j-cluster, obtained from the
+// minimum image of the cluster centers, so the tiles do not apply PBC per pair.
+
+static int CompareZ(const void * a, const void * b)
+{
+  const double * za = a;
+  const double * zb = b;
+  return (za[0] > zb[0]) - (za[0] < zb[0]);
+}
+
+static void ClusterBox(struct ClusterList * Clusters, int c, double * center, double * half)
+{
+  double lo[3] = {  GSL_POSINF,  GSL_POSINF,  GSL_POSINF};
+  double hi[3] = { -GSL_POSINF, -GSL_POSINF, -GSL_POSINF};
+  for (int a=0;a<ClusterSize;a++)
+  {
+    int k = c*ClusterSize + a;
+    if (Clusters->Atom[k] < 0)
+      continue;
+    double r[3] = {Clusters->x[k], Clusters->y[k], Clusters->z[k]};
+    for (int d=0;d<3;d++)
+    {
+      lo[d] = min(lo[d], r[d]);
+      hi[d] = max(hi[d], r[d]);
+    }
+  }
+  for (int d=0;d<3;d++)
+  {
+    center[d] = 0.5*(hi[d]+lo[d]);
+    half[d]   = 0.5*(hi[d]-lo[d]);
+  }
+}
+
+// Returns 1 if the bounding boxes of clusters c1 and c2 are closer than Rcut
+// and stores the periodic shift of c2 (to be added to its coordinates)
+
+static int ClusterPairInRange(struct ClusterList * Clusters, int c1, int c2, double * shift)
+{
+  const double L[3] = {Lx, Ly, Lz};
+  double gap2 = 0.0;
+  for (int d=0;d<3;d++)
+  {
+    double delta  = Clusters->Center[3*c1+d] - Clusters->Center[3*c2+d];
+    shift[d]      = L[d]*round(delta/L[d]);
+    delta        -= shift[d];
+    double gap    = fabs(delta) - Clusters->Half[3*c1+d] - Clusters->Half[3*c2+d];
+    if (gap > 0.0)
+      gap2 += gap*gap;
+  }
+  return (gap2 <= Rcut*Rcut);
+}
+
+void Compute_ClusterList(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                         gsl_vector * List, struct ClusterList * Clusters)
+{
+  int NCells = Mx*My*Mz;
+
+  // Number of clusters of each cell
+  int * Count = calloc(NCells, sizeof(int));
+  for (int i=0;i<NParticles;i++)
+    Count[FindParticle(Positions,i)]++;
+
+  Clusters->NClusters = 0;
+  for (int cell=0;cell<NCells;cell++)
+  {
+    Clusters->CellFirst[cell] = Clusters->NClusters;
+    Clusters->NClusters      += (Count[cell] + ClusterSize - 1) / ClusterSize;
+  }
+  Clusters->CellFirst[NCells] = Clusters->NClusters;
+  free(Count);
+
+  // Worst case: every cell has a padded cluster
+  if (Clusters->NClusters > Clusters->MaxClusters)
+  {
+    PrintMsg("Error building cluster list: too many clusters. Exiting now...");
+    exit(EXIT_FAILURE);
+  }
+
+  // Fill the clusters with the particles of each cell sorted in z
+  #pragma omp parallel for schedule(dynamic)
+  for (int cell=0;cell<NCells;cell++)
+  {
+    int      n      = 0;
+    int      nmax   = 16;
+    double * Sorted = malloc(2*nmax*sizeof(double));
+    int      j      = gsl_vector_get(ListHead,cell);
+    while (j >= 0)
+    {
+      if (n == nmax)
+      {
+        nmax  *= 2;
+        Sorted = realloc(Sorted, 2*nmax*sizeof(double));
+      }
+      Sorted[2*n]   = gsl_matrix_get(Positions,j,3);
+      Sorted[2*n+1] = j;
+      n++;
+      j = gsl_vector_get(List,j);
+    }
+    qsort(Sorted, n, 2*sizeof(double), CompareZ);
+
+    int first = Clusters->CellFirst[cell]*ClusterSize;
+    int last  = Clusters->CellFirst[cell+1]*ClusterSize;
+    for (int k=first;k<last;k++)
+    {
+      int m = k - first;
+      if (m < n)
+      {
+        int i = (int) Sorted[2*m+1];
+        Clusters->Atom[k] = i;
+        Clusters->Type[k] = (int) gsl_matrix_get(Positions,i,0);
+        Clusters->x[k]    = gsl_matrix_get(Positions,i,1);
+        Clusters->y[k]    = gsl_matrix_get(Positions,i,2);
+        Clusters->z[k]    = gsl_matrix_get(Positions,i,3);
+      }
+      else
+      {
+        Clusters->Atom[k] = -1;
+        Clusters->Type[k] = 0;
+        Clusters->x[k]    = 0.0;
+        Clusters->y[k]    = 0.0;
+        Clusters->z[k]    = 0.0;
+      }
+    }
+    free(Sorted);
+  }
+
+  // Bounding boxes
+  #pragma omp parallel for
+  for (int c=0;c<Clusters->NClusters;c++)
+    ClusterBox(Clusters, c, Clusters->Center + 3*c, Clusters->Half + 3*c);
+
+  // Cluster-pair list: count, offsets and fill
+  #pragma omp parallel for schedule(dynamic)
+  for (int cell=0;cell<NCells;cell++)
+  {
+    double shift[3];
+    for (int c1=Clusters->CellFirst[cell];c1<Clusters->CellFirst[cell+1];c1++)
+    {
+      int n = 0;
+      for (int k=0;k<27;k++)
+      {
+        int ncell = gsl_matrix_get(Neighbors,cell,k);
+        for (int c2=Clusters->CellFirst[ncell];c2<Clusters->CellFirst[ncell+1];c2++)
+          n += ClusterPairInRange(Clusters, c1, c2, shift);
+      }
+      Clusters->PairFirst[c1+1] = n;
+    }
+  }
+  Clusters->PairFirst[0] = 0;
+  for (int c=0;c<Clusters->NClusters;c++)
+    Clusters->PairFirst[c+1] += Clusters->PairFirst[c];
+
+  int NPairs = Clusters->PairFirst[Clusters->NClusters];
+  if (NPairs > Clusters->MaxPairs)
+  {
+    Clusters->MaxPairs = NPairs;
+    Clusters->Pair     = realloc(Clusters->Pair, NPairs*sizeof(int));
+    Clusters->Shift    = realloc(Clusters->Shift, 3*NPairs*sizeof(double));
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int cell=0;cell<NCells;cell++)
+  {
+    for (int c1=Clusters->CellFirst[cell];c1<Clusters->CellFirst[cell+1];c1++)
+    {
+      int p = Clusters->PairFirst[c1];
+      for (int k=0;k<27;k++)
+      {
+        int ncell = gsl_matrix_get(Neighbors,cell,k);
+        for (int c2=Clusters->CellFirst[ncell];c2<Clusters->CellFirst[ncell+1];c2++)
+        {
+          // The shift of a rejected c2 must not land in the slot p, which
+          // may already belong to the next cell (another thread)
+          double shift[3];
+          if (ClusterPairInRange(Clusters, c1, c2, shift))
+          {
+            Clusters->Pair[p] = c2;
+            for (int d=0;d<3;d++)
+              Clusters->Shift[3*p+d] = shift[d];
+            p++;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Evaluate the tile (c1, c2). Forces and energies are accumulated in fi and ei
+// (ClusterSize entries each). Skip[a] is 1 if particle a of c1 must ignore the
+// type2 particles (they are given by the wall grid)
+
+static void ClusterTile(struct ClusterList * Clusters, int c1, int c2, const double * shift,
+                        int type1, int type2, int AllLJ, const int * Skip,
+                        double (*fi)[3], double * ei)
+{
+  for (int a=0;a<ClusterSize;a++)
+  {
+    int ka = c1*ClusterSize + a;
+    int ti = Clusters->Type[ka];
+    if (ti == 0)
+      continue;
+    real xi = Clusters->x[ka] - shift[0];
+    real yi = Clusters->y[ka] - shift[1];
+    real zi = Clusters->z[ka] - shift[2];
+    const struct PairParameters * row = PairTable + ti*(NTypes+1);
+
+    // Accumulators are always double
+    double fx = 0.0, fy = 0.0, fz = 0.0, e = 0.0;
+
+    if (AllLJ)
+    {
+      // Branch free LJ, so that the loop over the j-cluster is vectorized. It
+      // is evaluated in real (float with __SINGLE_PRECISION__)
+      #pragma omp simd reduction(+:fx,fy,fz,e)
+      for (int b=0;b<ClusterSize;b++)
+      {
+        int  kb     = c2*ClusterSize + b;
+        int  tj     = Clusters->Type[kb];
+        real deltax = xi - Clusters->x[kb];
+        real deltay = yi - Clusters->y[kb];
+        real deltaz = zi - Clusters->z[kb];
+        real r2     = deltax*deltax + deltay*deltay + deltaz*deltaz;
+
+        const struct PairParameters * pair = row + tj;
+        real epsilon = pair->epsilon;
+        real sigma2  = pair->sigma2;
+        real ecut    = pair->ecut;
+        real rcut2   = pair->rcut2;
+
+        real inside = (tj > 0) && (r2 != 0) && (r2 <= rcut2) && !(Skip[a] && IsOfType(tj, type2));
+        real filter = (((type1 == 0)&&(type2 == 0)) || (IsOfType(ti, type1)&&IsOfType(tj, type2)));
+
+        real r2inv = inside / (r2 + (1.0f - inside));
+        real r2i   = sigma2*r2inv;
+        real r6i   = r2i*r2i*r2i;
+        real ff    = 48.0f*epsilon*r2inv*r6i*(r6i-0.5f);
+
+        e  += inside*(4.0f*epsilon*r6i*(r6i-1.0f)-ecut);
+        fx += filter*ff*deltax;
+        fy += filter*ff*deltay;
+        fz += filter*ff*deltaz;
+      }
+    }
+    else
+    {
+      for (int b=0;b<ClusterSize;b++)
+      {
+        int  kb     = c2*ClusterSize + b;
+        int  tj     = Clusters->Type[kb];
+        real deltax = xi - Clusters->x[kb];
+        real deltay = yi - Clusters->y[kb];
+        real deltaz = zi - Clusters->z[kb];
+        real r2     = deltax*deltax + deltay*deltay + deltaz*deltaz;
+
+        const struct PairParameters * pair = row + tj;
+        if ((tj == 0) || (r2 == 0) || (r2 > pair->rcut2) || (Skip[a] && IsOfType(tj, type2)))
+          continue;
+        double filter = (((type1 == 0)&&(type2 == 0)) || (IsOfType(ti, type1)&&IsOfType(tj, type2)));
+
+        double ff;
+        e  += Eval_Pair(pair, r2, &ff);
+        fx += filter*ff*deltax;
+        fy += filter*ff*deltay;
+        fz += filter*ff*deltaz;
+      }
+    }
+
+    fi[a][0] += fx;
+    fi[a][1] += fy;
+    fi[a][2] += fz;
+    ei[a]    += e;
+  }
+}
+
+void Compute_Forces_Cluster(gsl_matrix * Velocities, struct ClusterList * Clusters,
+                            int type1, int type2, struct WallGrid * Grid,
+                            gsl_matrix * Forces, gsl_vector * Energy, gsl_vector * Kinetic)
+{
+  gsl_matrix_set_zero(Forces);
+  gsl_vector_set_zero(Energy);
+  gsl_vector_set_zero(Kinetic);
+
+  // The vectorized tile is used if every pair is LJ
+  int AllLJ = AllPairsLJ;
+
+  #pragma omp parallel for schedule(dynamic,16)
+  for (int c1=0;c1<Clusters->NClusters;c1++)
+  {
+    double fi[ClusterSize][3];
+    double ei[ClusterSize];
+    int    Skip[ClusterSize];
+    int    Visit = 0;
+
+    // Same particles as in Compute_Forces: only the clusters with type1
+    // particles, and only those are written (the walls are left to Compute_Walls)
+    for (int a=0;a<ClusterSize;a++)
+    {
+      int k = c1*ClusterSize + a;
+      fi[a][0] = fi[a][1] = fi[a][2] = ei[a] = 0.0;
+      Skip[a]  = 0;
+      Visit   |= IsOfType(Clusters->Type[k], type1);
+      if ((Grid != NULL) && IsOfType(Clusters->Type[k], type1))
+      {
+        Skip[a] = 1;
+        ei[a]   = InterpolateWallGrid(Grid, Clusters->Type[k], Clusters->x[k], Clusters->y[k],
+                                      Clusters->z[k], fi[a]);
+      }
+    }
+    if (!Visit)
+      continue;
+
+    for (int p=Clusters->PairFirst[c1];p<Clusters->PairFirst[c1+1];p++)
+      ClusterTile(Clusters, c1, Clusters->Pair[p], Clusters->Shift + 3*p, type1, type2,
+                  AllLJ, Skip, fi, ei);
+
+    for (int a=0;a<ClusterSize;a++)
+    {
+      int i = Clusters->Atom[c1*ClusterSize + a];
+      if ((i < 0) || !IsOfType(Clusters->Type[c1*ClusterSize + a], type1))
+        continue;
+      gsl_vector_view vi = gsl_matrix_row(Velocities, i);
+      gsl_vector_set(Kinetic,i,KineticEnergy(&vi.vector, Clusters->Type[c1*ClusterSize + a]));
+      Forces->data[i*Forces->tda + 0] = fi[a][0];
+      Forces->data[i*Forces->tda + 1] = fi[a][1];
+      Forces->data[i*Forces->tda + 2] = fi[a][2];
+      Energy->data[i*Energy->stride]  = ei[a];
+    }
+  }
+}
+
+void Check_ClusterForces(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Neighbors,
+                         gsl_vector * ListHead, gsl_vector * List, struct TypeList * Types,
+                         struct ClusterList * Clusters, int type1, int type2,
+                         struct WallGrid * Grid)
+{
+  gsl_matrix * Forces1  = gsl_matrix_calloc(NParticles,3);
+  gsl_matrix * Forces2  = gsl_matrix_calloc(NParticles,3);
+  gsl_vector * Energy1  = gsl_vector_calloc(NParticles);
+  gsl_vector * Energy2  = gsl_vector_calloc(NParticles);
+  gsl_vector * Kinetic  = gsl_vector_calloc(NParticles);
+
+  double t0 = omp_get_wtime();
+  Compute_Forces(Positions, Velocities, Neighbors, ListHead, List, Types, type1, type2,
+                 Grid, NULL, Forces1, Energy1, Kinetic);
+  double t1 = omp_get_wtime();
+  Compute_ClusterList(Positions, Neighbors, ListHead, List, Clusters);
+  double t2 = omp_get_wtime();
+  Compute_Forces_Cluster(Velocities, Clusters, type1, type2, Grid, Forces2, Energy2,
+                         Kinetic);
+  double t3 = omp_get_wtime();
+
+  double MaxError = 0.0;
+  double MaxForce = 0.0;
+  double MaxEnergyError = 0.0;
+  for (int i=0;i<NParticles;i++)
+  {
+    for (int d=0;d<3;d++)
+    {
+      MaxError = max(MaxError, fabs(gsl_matrix_get(Forces1,i,d) - gsl_matrix_get(Forces2,i,d)));
+      MaxForce = max(MaxForce, fabs(gsl_matrix_get(Forces1,i,d)));
+    }
+    MaxEnergyError = max(MaxEnergyError, fabs(gsl_vector_get(Energy1,i) - gsl_vector_get(Energy2,i)));
+  }
+
+  int NPairs = Clusters->PairFirst[Clusters->NClusters];
+  printf("\tClusters of %d particles: %d clusters, %d cluster pairs (%.1f%% of the tile pairs are within Rcut)\n",
+         ClusterSize, Clusters->NClusters, NPairs,
+         100.0 * ClusterPairEfficiency(Clusters));
+  printf("\tVerlet lists:  %f s\n", t1-t0);
+  printf("\tCluster pairs: %f s (list) + %f s (forces)\n", t2-t1, t3-t2);
+  printf("\tMax. difference in forces: %e (max. force: %e)\n", MaxError, MaxForce);
+  printf("\tMax. difference in energies: %e\n", MaxEnergyError);
+
+  gsl_matrix_free(Forces1);
+  gsl_matrix_free(Forces2);
+  gsl_vector_free(Energy1);
+  gsl_vector_free(Energy2);
+  gsl_vector_free(Kinetic);
+}
+
+double ClusterPairEfficiency(struct ClusterList * Clusters)
+{
+  long Inside = 0;
+  long Total  = 0;
+  #pragma omp parallel for reduction(+:Inside,Total) schedule(dynamic,16)
+  for (int c1=0;c1<Clusters->NClusters;c1++)
+  {
+    for (int p=Clusters->PairFirst[c1];p<Clusters->PairFirst[c1+1];p++)
+    {
+      int c2 = Clusters->Pair[p];
+      const double * shift = Clusters->Shift + 3*p;
+      for (int a=0;a<ClusterSize;a++)
+      {
+        int ka = c1*ClusterSize + a;
+        for (int b=0;b<ClusterSize;b++)
+        {
+          int kb = c2*ClusterSize + b;
+          double deltax = Clusters->x[ka] - shift[0] - Clusters->x[kb];
+          double deltay = Clusters->y[ka] - shift[1] - Clusters->y[kb];
+          double deltaz = Clusters->z[ka] - shift[2] - Clusters->z[kb];
+          double r2     = deltax*deltax + deltay*deltay + deltaz*deltaz;
+          Inside += (Clusters->Type[ka] > 0) && (Clusters->Type[kb] > 0) && (r2 <= Rcut*Rcut);
+          Total++;
+        }
+      }
+    }
+  }
+  return (Total > 0) ? (double) Inside / Total : 0.0;
+}
+
+void AllocClusterList(struct ClusterList * Clusters)
+{
+  // The shift of a cluster pair is only valid for all its particle pairs if the
+  // box is larger than twice Rcut plus the size of a cell
+  if ((Lx < 2*(Rcut+Lx/Mx)) || (Ly < 2*(Rcut+Ly/My)) || (Lz < 2*(Rcut+Lz/Mz)))
+  {
+    PrintMsg("Error: the box is too small for the cluster-pair engine. Exiting now...");
+    exit(EXIT_FAILURE);
+  }
+
+  // At most one padded cluster per cell
+  Clusters->MaxClusters = NParticles / ClusterSize + Mx*My*Mz;
+  Clusters->NClusters   = 0;
+  Clusters->MaxPairs    = 0;
+
+  long n = (long) Clusters->MaxClusters * ClusterSize;
+  Clusters->Atom      = malloc(n*sizeof(int));
+  Clusters->Type      = malloc(n*sizeof(int));
+  Clusters->x         = malloc(n*sizeof(real));
+  Clusters->y         = malloc(n*sizeof(real));
+  Clusters->z         = malloc(n*sizeof(real));
+  Clusters->Center    = malloc(3*Clusters->MaxClusters*sizeof(double));
+  Clusters->Half      = malloc(3*Clusters->MaxClusters*sizeof(double));
+  Clusters->CellFirst = malloc((Mx*My*Mz+1)*sizeof(int));
+  Clusters->PairFirst = malloc((Clusters->MaxClusters+1)*sizeof(int));
+  Clusters->Pair      = NULL;
+  Clusters->Shift     = NULL;
+}
+
+void FreeClusterList(struct ClusterList * Clusters)
+{
+  free(Clusters->Atom);
+  free(Clusters->Type);
+  free(Clusters->x);
+  free(Clusters->y);
+  free(Clusters->z);
+  free(Clusters->Center);
+  free(Clusters->Half);
+  free(Clusters->CellFirst);
+  free(Clusters->PairFirst);
+  free(Clusters->Pair);
+  free(Clusters->Shift);
+}
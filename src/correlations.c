@@ -0,0 +1,535 @@
+/*
+ * Filename   : correlations.c
+ *
+ * Created    : 20.10.2026
+ *
+ * Modified   : mar 20 oct 2026 16:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Time correlation matrices of the mesoscopic fields computed
+ *              with FFTs over blocks of snapshots, equal time covariance
+ *              matrices (rank k updates) and streaming POD modes
+ *
+ */
+
+#include "cg.h"
+
+// The raw correlation  R(t) = sum_s A(s+t) B(s)  of two series is split in
+// blocks of M frames of B: the block that starts at frame k M needs A from k M
+// to k M + 2 M,  so the window of N = 2 M frames is transformed (A),  and so are
+// its first M frames padded with zeros (B).  Since t < M,  the circular
+// correlation of both (the inverse of A conj(B))  does not wrap around.  The
+// window then moves M frames forward. The means are subtracted at the end:
+//   C(t) = [R(t) - <B> sum_{u>=t} A(u) - <A> sum_{s<T-t} B(s)] / (T-t) + <A><B>
+
+static const char * CorrNames[NCorrFields] = {"rho", "gx", "gy", "gz", "e"};
+
+static inline void Field_Values(gsl_vector * MesoDensity, gsl_matrix * MesoMomentum,
+                                gsl_vector * MesoEnergy, gsl_vector * MesoKinetic,
+                                int mu, double * Value)
+{
+  Value[CorrDensity]   = gsl_vector_get(MesoDensity,mu);
+  Value[CorrMomentumX] = gsl_matrix_get(MesoMomentum,mu,0);
+  Value[CorrMomentumY] = gsl_matrix_get(MesoMomentum,mu,1);
+  Value[CorrMomentumZ] = gsl_matrix_get(MesoMomentum,mu,2);
+  Value[CorrEnergy]    = gsl_vector_get(MesoEnergy,mu) + gsl_vector_get(MesoKinetic,mu);
+}
+
+void AllocCorrelations(struct Correlations * Corr)
+{
+  int pairs[][2] = CorrelationPairs;
+
+  Corr->NPairs = sizeof(pairs) / sizeof(pairs[0]);
+  Corr->Pairs  = malloc(2*Corr->NPairs*sizeof(int));
+  for (int p=0;p<Corr->NPairs;p++)
+  {
+    for (int a=0;a<2;a++)
+    {
+      if ((pairs[p][a] < 0) || (pairs[p][a] >= NCorrFields))
+      {
+        PrintMsg("Error in CorrelationPairs: unknown field. Exiting now...");
+        printf("\tPair %d has fields %d and %d\n", p, pairs[p][0], pairs[p][1]);
+        exit(EXIT_FAILURE);
+      }
+      Corr->Pairs[2*p+a] = pairs[p][a];
+    }
+  }
+
+  // Radix 2 FFTs
+  Corr->M = 1;
+  while (Corr->M < CorrelationMaxLag)
+    Corr->M *= 2;
+  Corr->N = 2*Corr->M;
+
+  int NSeries   = NCorrFields*NNodes;
+  Corr->NFrames = 0;
+  Corr->NBuffer = 0;
+  Corr->Buffer  = calloc(NSeries*Corr->N, sizeof(double));
+  Corr->Sum     = calloc(NSeries, sizeof(double));
+  Corr->Head    = calloc(NSeries*(CorrelationMaxLag+1), sizeof(double));
+  Corr->Tail    = calloc(NSeries*CorrelationMaxLag, sizeof(double));
+  Corr->Raw     = calloc(Corr->NPairs*NNodes*NNodes*CorrelationMaxLag, sizeof(double));
+}
+
+void FreeCorrelations(struct Correlations * Corr)
+{
+  free(Corr->Pairs);
+  free(Corr->Buffer);
+  free(Corr->Sum);
+  free(Corr->Head);
+  free(Corr->Tail);
+  free(Corr->Raw);
+}
+
+// Correlations of the first min(M,n) frames of the buffer with its n frames
+
+static void Correlate_Window(struct Correlations * Corr, int n)
+{
+  int      N       = Corr->N;
+  int      M       = Corr->M;
+  int      nB      = (n < M) ? n : M;
+  int      NSeries = NCorrFields*NNodes;
+  double * X       = malloc(NSeries*N*sizeof(double));
+  double * Y       = malloc(NSeries*N*sizeof(double));
+
+  #pragma omp parallel for schedule(static)
+  for (int s=0;s<NSeries;s++)
+  {
+    double * x = X + s*N;
+    double * y = Y + s*N;
+    for (int t=0;t<N;t++)
+    {
+      x[t] = (t < n)  ? Corr->Buffer[s*N+t] : 0.0;
+      y[t] = (t < nB) ? Corr->Buffer[s*N+t] : 0.0;
+    }
+    gsl_fft_real_radix2_transform(x, 1, N);
+    gsl_fft_real_radix2_transform(y, 1, N);
+  }
+
+  #pragma omp parallel
+  {
+    double * W = malloc(N*sizeof(double));
+
+    #pragma omp for schedule(dynamic)
+    for (int l=0;l<Corr->NPairs*NNodes;l++)
+    {
+      int      p  = l / NNodes;
+      int      mu = l % NNodes;
+      double * a  = X + (Corr->Pairs[2*p]*NNodes + mu)*N;
+
+      for (int nu=0;nu<NNodes;nu++)
+      {
+        double * b = Y + (Corr->Pairs[2*p+1]*NNodes + nu)*N;
+
+        // a conj(b) in halfcomplex storage (real parts in 0..N/2, imaginary
+        // parts in N-1..N/2+1)
+        W[0]   = a[0]*b[0];
+        W[N/2] = a[N/2]*b[N/2];
+        for (int k=1;k<N/2;k++)
+        {
+          W[k]   = a[k]*b[k]   + a[N-k]*b[N-k];
+          W[N-k] = a[N-k]*b[k] - a[k]*b[N-k];
+        }
+        gsl_fft_halfcomplex_radix2_inverse(W, 1, N);
+
+        double * R = Corr->Raw + (l*NNodes + nu)*CorrelationMaxLag;
+        for (int t=0;t<CorrelationMaxLag;t++)
+          R[t] += W[t];
+      }
+    }
+
+    free(W);
+  }
+
+  // Move the window M frames forward
+  Corr->NBuffer = (n > M) ? n - M : 0;
+  for (int s=0;s<NSeries;s++)
+    memmove(Corr->Buffer + s*N, Corr->Buffer + s*N + M, Corr->NBuffer*sizeof(double));
+
+  free(X);
+  free(Y);
+}
+
+void Compute_Correlations(struct Correlations * Corr, gsl_vector * MesoDensity,
+                          gsl_matrix * MesoMomentum, gsl_vector * MesoEnergy,
+                          gsl_vector * MesoKinetic)
+{
+  int t = Corr->NFrames;
+
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    double Value[NCorrFields];
+    Field_Values(MesoDensity, MesoMomentum, MesoEnergy, MesoKinetic, mu, Value);
+
+    for (int f=0;f<NCorrFields;f++)
+    {
+      int s = f*NNodes + mu;
+      Corr->Buffer[s*Corr->N + Corr->NBuffer] = Value[f];
+      Corr->Sum[s] += Value[f];
+      if (t < CorrelationMaxLag)
+        Corr->Head[s*(CorrelationMaxLag+1)+t+1] = Corr->Head[s*(CorrelationMaxLag+1)+t] + Value[f];
+      Corr->Tail[s*CorrelationMaxLag + t%CorrelationMaxLag] = Value[f];
+    }
+  }
+
+  Corr->NFrames++;
+  Corr->NBuffer++;
+  if (Corr->NBuffer == Corr->N)
+    Correlate_Window(Corr, Corr->N);
+}
+
+void SaveCorrelations(char * basename, struct Correlations * Corr)
+{
+  char str[100];
+  int  T       = Corr->NFrames;
+  int  NLags   = (T < CorrelationMaxLag) ? T : CorrelationMaxLag;
+  int  NSeries = NCorrFields*NNodes;
+
+  // Frames left in the buffer
+  while (Corr->NBuffer > 0)
+    Correlate_Window(Corr, Corr->NBuffer);
+
+  // Sums of the last t frames of each series
+  double * Last = calloc(NSeries, sizeof(double));
+
+  FILE ** oFile = malloc(Corr->NPairs*sizeof(FILE *));
+  for (int p=0;p<Corr->NPairs;p++)
+  {
+    sprintf(str, "./output/%s.Correlation_%s_%s.dat", basename,
+            CorrNames[Corr->Pairs[2*p]], CorrNames[Corr->Pairs[2*p+1]]);
+    oFile[p] = fopen(str, "w");
+  }
+
+  for (int t=0;t<NLags;t++)
+  {
+    for (int p=0;p<Corr->NPairs;p++)
+    {
+      fprintf(oFile[p], "%10d", t);
+      for (int mu=0;mu<NNodes;mu++)
+      {
+        int    A  = Corr->Pairs[2*p]*NNodes + mu;
+        double mA = Corr->Sum[A]/T;
+        double SA = Corr->Sum[A] - Corr->Head[A*(CorrelationMaxLag+1)+t];
+        for (int nu=0;nu<NNodes;nu++)
+        {
+          int    B  = Corr->Pairs[2*p+1]*NNodes + nu;
+          double mB = Corr->Sum[B]/T;
+          double SB = Corr->Sum[B] - Last[B];
+          double R  = Corr->Raw[((p*NNodes + mu)*NNodes + nu)*CorrelationMaxLag + t];
+          fprintf(oFile[p], "\t%8.6e", (R - mB*SA - mA*SB)/(T-t) + mA*mB);
+        }
+      }
+      fprintf(oFile[p], "\n");
+    }
+
+    for (int s=0;s<NSeries;s++)
+      Last[s] += Corr->Tail[s*CorrelationMaxLag + (T-1-t)%CorrelationMaxLag];
+  }
+
+  for (int p=0;p<Corr->NPairs;p++)
+    fclose(oFile[p]);
+  free(oFile);
+  free(Last);
+}
+
+/* #############################################################################
+#  Equal time covariance matrices
+############################################################################# */
+
+// The snapshots of each field are stored as the columns of a NNodes x
+// CovarianceBatch block X, and every full block adds X X^T to the sum of the
+// outer products (dsyrk, lower triangle).  The first snapshot is subtracted
+// from all of them,  so the covariance does not lose digits when the
+// fluctuations are small compared to the mean (e.g. the density)
+
+void AllocCovariance(struct Covariance * Cov)
+{
+  Cov->NFrames = 0;
+  Cov->NBatch  = 0;
+  Cov->Shift   = calloc(NCorrFields*NNodes, sizeof(double));
+  Cov->Sum     = calloc(NCorrFields*NNodes, sizeof(double));
+  for (int f=0;f<NCorrFields;f++)
+  {
+    Cov->Batch[f] = gsl_matrix_calloc(NNodes, CovarianceBatch);
+    Cov->XX[f]    = gsl_matrix_calloc(NNodes, NNodes);
+  }
+}
+
+void FreeCovariance(struct Covariance * Cov)
+{
+  free(Cov->Shift);
+  free(Cov->Sum);
+  for (int f=0;f<NCorrFields;f++)
+  {
+    gsl_matrix_free(Cov->Batch[f]);
+    gsl_matrix_free(Cov->XX[f]);
+  }
+}
+
+static void Update_Covariance(struct Covariance * Cov)
+{
+  #pragma omp parallel for schedule(static)
+  for (int f=0;f<NCorrFields;f++)
+  {
+    gsl_matrix_view X = gsl_matrix_submatrix(Cov->Batch[f], 0, 0, NNodes, Cov->NBatch);
+    gsl_blas_dsyrk(CblasLower, CblasNoTrans, 1.0, &X.matrix, 1.0, Cov->XX[f]);
+  }
+  Cov->NBatch = 0;
+}
+
+void Compute_Covariance(struct Covariance * Cov, gsl_vector * MesoDensity,
+                        gsl_matrix * MesoMomentum, gsl_vector * MesoEnergy,
+                        gsl_vector * MesoKinetic)
+{
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    double Value[NCorrFields];
+    Field_Values(MesoDensity, MesoMomentum, MesoEnergy, MesoKinetic, mu, Value);
+
+    for (int f=0;f<NCorrFields;f++)
+    {
+      int s = f*NNodes + mu;
+      if (Cov->NFrames == 0)
+        Cov->Shift[s] = Value[f];
+      double x = Value[f] - Cov->Shift[s];
+      gsl_matrix_set(Cov->Batch[f], mu, Cov->NBatch, x);
+      Cov->Sum[s] += x;
+    }
+  }
+
+  Cov->NFrames++;
+  Cov->NBatch++;
+  if (Cov->NBatch == CovarianceBatch)
+    Update_Covariance(Cov);
+}
+
+void SaveCovariance(char * basename, struct Covariance * Cov)
+{
+  char str[100];
+  int  T = Cov->NFrames;
+
+  if (Cov->NBatch > 0)
+    Update_Covariance(Cov);
+
+  gsl_matrix * C                = gsl_matrix_calloc(NNodes, NNodes);
+  gsl_vector * Eigen            = gsl_vector_calloc(NNodes);
+  gsl_eigen_symm_workspace * ws = gsl_eigen_symm_alloc(NNodes);
+
+  for (int f=0;f<NCorrFields;f++)
+  {
+    // <x x^T> - <x><x^T> (from the lower triangle)
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      for (int nu=0;nu<=mu;nu++)
+      {
+        double c = gsl_matrix_get(Cov->XX[f],mu,nu)/T
+                 - (Cov->Sum[f*NNodes+mu]/T)*(Cov->Sum[f*NNodes+nu]/T);
+        gsl_matrix_set(C, mu, nu, c);
+        gsl_matrix_set(C, nu, mu, c);
+      }
+    }
+
+    sprintf(str, "./output/%s.Covariance_%s.dat", basename, CorrNames[f]);
+    FILE * oFile = fopen(str, "w");
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      gsl_vector_view row = gsl_matrix_row(C, mu);
+      PrintInfo(mu, &row.vector, oFile);
+    }
+    fclose(oFile);
+
+    // Eigenvalues in decreasing order (gsl_eigen_symm destroys C)
+    gsl_eigen_symm(C, Eigen, ws);
+    gsl_sort_vector(Eigen);
+    sprintf(str, "./output/%s.Covariance_%s.eigen.dat", basename, CorrNames[f]);
+    oFile = fopen(str, "w");
+    for (int k=0;k<NNodes;k++)
+      fprintf(oFile, "%10d\t%8.6e\n", k, gsl_vector_get(Eigen,NNodes-1-k));
+    fclose(oFile);
+  }
+
+  gsl_eigen_symm_free(ws);
+  gsl_vector_free(Eigen);
+  gsl_matrix_free(C);
+}
+
+/* #############################################################################
+#  Streaming proper orthogonal decomposition
+############################################################################# */
+
+// The PODRank leading left singular vectors U and values S of the centered
+// snapshots are updated every PODBlock snapshots X with the thin SVD of
+//   [ U S | X - m_X | sqrt(n b/(n+b)) (m_X - m) ]
+// where m is the mean of the n snapshots already in the basis and m_X the mean
+// of the b new ones (the last column moves the basis to the new mean). Without
+// truncation this is the exact SVD of all the centered snapshots, and the
+// memory is NNodes x (PODRank + PODBlock + 1) whatever NSteps
+
+// Thin SVD of LAPACK (Fortran, column major)
+
+void dgesdd_(const char * jobz, const int * m, const int * n, double * a, const int * lda,
+             double * s, double * u, const int * ldu, double * vt, const int * ldvt,
+             double * work, const int * lwork, int * iwork, int * info);
+
+void AllocPOD(struct StreamingPOD * Pod)
+{
+  Pod->NFrames = 0;
+  Pod->NBlock  = 0;
+  Pod->Mean    = calloc(NCorrFields*NNodes, sizeof(double));
+  for (int f=0;f<NCorrFields;f++)
+  {
+    Pod->Rank[f]  = 0;
+    Pod->Block[f] = gsl_matrix_calloc(NNodes, PODBlock);
+    Pod->Modes[f] = gsl_matrix_calloc(NNodes, PODRank);
+    Pod->Sigma[f] = gsl_vector_calloc(PODRank);
+  }
+}
+
+void FreePOD(struct StreamingPOD * Pod)
+{
+  free(Pod->Mean);
+  for (int f=0;f<NCorrFields;f++)
+  {
+    gsl_matrix_free(Pod->Block[f]);
+    gsl_matrix_free(Pod->Modes[f]);
+    gsl_vector_free(Pod->Sigma[f]);
+  }
+}
+
+static void Update_POD(struct StreamingPOD * Pod)
+{
+  int b = Pod->NBlock;
+  int n = Pod->NFrames - b;
+
+  #pragma omp parallel for schedule(static)
+  for (int f=0;f<NCorrFields;f++)
+  {
+    int      r    = Pod->Rank[f];
+    int      Cols = r + b + (n > 0);
+    double * Mean = Pod->Mean + f*NNodes;
+    double   mX[NNodes];
+
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      mX[mu] = 0.0;
+      for (int c=0;c<b;c++)
+        mX[mu] += gsl_matrix_get(Pod->Block[f],mu,c);
+      mX[mu] /= b;
+    }
+
+    gsl_matrix * A = gsl_matrix_alloc(NNodes, Cols);
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      for (int j=0;j<r;j++)
+        gsl_matrix_set(A, mu, j, gsl_matrix_get(Pod->Modes[f],mu,j)*gsl_vector_get(Pod->Sigma[f],j));
+      for (int c=0;c<b;c++)
+        gsl_matrix_set(A, mu, r+c, gsl_matrix_get(Pod->Block[f],mu,c) - mX[mu]);
+      if (n > 0)
+        gsl_matrix_set(A, mu, r+b, sqrt((double) n*b/(n+b))*(mX[mu] - Mean[mu]));
+    }
+
+    // Thin SVD with LAPACK (divide and conquer). The rows of A are the columns
+    // of the Fortran matrix A^T = V S U^T, so its right singular vectors  (vt,
+    // NSigma x NNodes in Fortran order) are U in rows: U(mu,j) = vt[mu*NSigma+j]
+    int          NSigma = min(NNodes, Cols);
+    int          Rows   = NNodes;
+    gsl_matrix * U      = gsl_matrix_alloc(NNodes, NSigma);
+    gsl_matrix * V      = gsl_matrix_alloc(NSigma, Cols);
+    gsl_vector * S      = gsl_vector_alloc(NSigma);
+    int        * IWork  = malloc(8*NSigma*sizeof(int));
+    double       Query;
+    int          LWork  = -1, Info;
+    dgesdd_("S", &Cols, &Rows, A->data, &Cols, S->data, V->data, &Cols, U->data,
+            &NSigma, &Query, &LWork, IWork, &Info);
+    LWork = (int) Query;
+    double * Work = malloc(LWork*sizeof(double));
+    dgesdd_("S", &Cols, &Rows, A->data, &Cols, S->data, V->data, &Cols, U->data,
+            &NSigma, Work, &LWork, IWork, &Info);
+    if (Info != 0)
+    {
+      PrintMsg("Error in the POD update: the SVD did not converge. Exiting now...");
+      printf("\tdgesdd info: %d\n", Info);
+      exit(EXIT_FAILURE);
+    }
+
+    // Truncation to PODRank (the singular values are in decreasing order). The
+    // sign of each mode makes its largest component positive
+    Pod->Rank[f] = min(PODRank, NSigma);
+    for (int j=0;j<Pod->Rank[f];j++)
+    {
+      int Largest = 0;
+      for (int mu=1;mu<NNodes;mu++)
+        if (fabs(gsl_matrix_get(U,mu,j)) > fabs(gsl_matrix_get(U,Largest,j)))
+          Largest = mu;
+      double Sign = (gsl_matrix_get(U,Largest,j) < 0.0) ? -1.0 : 1.0;
+
+      for (int mu=0;mu<NNodes;mu++)
+        gsl_matrix_set(Pod->Modes[f], mu, j, Sign*gsl_matrix_get(U,mu,j));
+      gsl_vector_set(Pod->Sigma[f], j, gsl_vector_get(S,j));
+    }
+
+    for (int mu=0;mu<NNodes;mu++)
+      Mean[mu] = (n*Mean[mu] + b*mX[mu])/(n+b);
+
+    gsl_matrix_free(A);
+    gsl_matrix_free(U);
+    gsl_matrix_free(V);
+    gsl_vector_free(S);
+    free(IWork);
+    free(Work);
+  }
+
+  Pod->NBlock = 0;
+}
+
+void Compute_POD(struct StreamingPOD * Pod, gsl_vector * MesoDensity,
+                 gsl_matrix * MesoMomentum, gsl_vector * MesoEnergy,
+                 gsl_vector * MesoKinetic)
+{
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    double Value[NCorrFields];
+    Field_Values(MesoDensity, MesoMomentum, MesoEnergy, MesoKinetic, mu, Value);
+    for (int f=0;f<NCorrFields;f++)
+      gsl_matrix_set(Pod->Block[f], mu, Pod->NBlock, Value[f]);
+  }
+
+  Pod->NFrames++;
+  Pod->NBlock++;
+  if (Pod->NBlock == PODBlock)
+    Update_POD(Pod);
+}
+
+void SavePOD(char * basename, struct StreamingPOD * Pod)
+{
+  char str[100];
+
+  if (Pod->NBlock > 0)
+    Update_POD(Pod);
+
+  for (int f=0;f<NCorrFields;f++)
+  {
+    int Rank = Pod->Rank[f];
+
+    sprintf(str, "./output/%s.POD_%s.modes.dat", basename, CorrNames[f]);
+    FILE * oFile = fopen(str, "w");
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      gsl_vector_view row = gsl_matrix_subrow(Pod->Modes[f], mu, 0, Rank);
+      PrintInfo(mu, &row.vector, oFile);
+    }
+    fclose(oFile);
+
+    // Singular values and variance of each mode (the eigenvalues of the
+    // covariance matrix)
+    sprintf(str, "./output/%s.POD_%s.spectrum.dat", basename, CorrNames[f]);
+    oFile = fopen(str, "w");
+    for (int k=0;k<Rank;k++)
+    {
+      double s = gsl_vector_get(Pod->Sigma[f],k);
+      fprintf(oFile, "%10d\t%8.6e\t%8.6e\n", k, s, s*s/Pod->NFrames);
+    }
+    fclose(oFile);
+  }
+}
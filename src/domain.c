@@ -0,0 +1,258 @@
+/*
+ * Filename   : domain.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 16:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Spatial domain decomposition of the force loop
+ *
+ */
+
+#include "cg.h"
+
+// Cells are numbered x first, then y, then z, so a contiguous range of cells is
+// a z-slab (possibly with partial layers at its ends). Each domain is one of
+// such ranges, as many as threads. The boundaries are chosen so that the
+// estimated cost of each range is the same. The cost of a cell is the number
+// of particles visited in it times the number of particles in its 27
+// neighboring cells.
+//
+// Each domain copies the particles of its cells and of their neighboring cells
+// (the halo) into a private buffer, sorted by cell, and only reads from it. The
+// buffer, the distances and the LJ are real (float with __SINGLE_PRECISION__).
+// Every particle is owned by one domain, so no reduction is needed.
+
+// LJ_Pair evaluated in real, as the LJ tile of the cluster-pair engine. Other
+// styles (tables) are evaluated in double through Eval_Pair
+
+static inline real LJ_PairReal(const struct PairParameters * pair, real r2, real * ff)
+{
+  real epsilon = pair->epsilon;
+  real r2inv   = 1.0f/r2;
+  real r2i     = (real) pair->sigma2*r2inv;
+  real r6i     = r2i*r2i*r2i;
+
+  *ff = 48.0f*epsilon*r2inv*r6i*(r6i-0.5f);
+
+  return 4.0f*epsilon*r6i*(r6i-1.0f)-(real) pair->ecut;
+}
+
+// Only the type1 particles are visited (the walls are left to Compute_Walls)
+
+static int Visited(int type, int type1)
+{
+  return (type1 == 0) || IsOfType(type, type1);
+}
+
+double Compute_Domains(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                       gsl_vector * List, int type1, int NDomains, int * DomainFirst)
+{
+  int      NCells = Mx*My*Mz;
+  int    * Count  = calloc(NCells, sizeof(int));
+  int    * Visit  = calloc(NCells, sizeof(int));
+  double * Cost   = calloc(NCells+1, sizeof(double));
+
+  for (int cell=0;cell<NCells;cell++)
+  {
+    int j = gsl_vector_get(ListHead,cell);
+    while (j >= 0)
+    {
+      Count[cell]++;
+      Visit[cell] += Visited((int) gsl_matrix_get(Positions,j,0), type1);
+      j = gsl_vector_get(List,j);
+    }
+  }
+
+  // Cost[cell] is the accumulated cost of the cells before cell
+  for (int cell=0;cell<NCells;cell++)
+  {
+    double n = 0.0;
+    for (int k=0;k<27;k++)
+      n += Count[(int) gsl_matrix_get(Neighbors,cell,k)];
+    Cost[cell+1] = Cost[cell] + Visit[cell]*n;
+  }
+
+  // Boundaries at equal fractions of the total cost
+  DomainFirst[0]        = 0;
+  DomainFirst[NDomains] = NCells;
+  int cell = 0;
+  for (int d=1;d<NDomains;d++)
+  {
+    double target = Cost[NCells]*d/NDomains;
+    while ((cell < NCells) && (Cost[cell+1] <= target))
+      cell++;
+    DomainFirst[d] = cell;
+  }
+
+  // Load imbalance: largest cost of a domain over the average
+  double MaxCost = 0.0;
+  for (int d=0;d<NDomains;d++)
+    MaxCost = max(MaxCost, Cost[DomainFirst[d+1]] - Cost[DomainFirst[d]]);
+  double Imbalance = (Cost[NCells] > 0.0) ? MaxCost*NDomains/Cost[NCells] : 1.0;
+
+  free(Count);
+  free(Visit);
+  free(Cost);
+
+  return Imbalance;
+}
+
+double Compute_Forces_Domain(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Neighbors,
+                             gsl_vector * ListHead, gsl_vector * List, int type1, int type2,
+                             struct WallGrid * Grid, gsl_matrix * Forces, gsl_vector * Energy,
+                             gsl_vector * Kinetic)
+{
+  gsl_matrix_set_zero(Forces);
+  gsl_vector_set_zero(Energy);
+  gsl_vector_set_zero(Kinetic);
+
+  int   NCells      = Mx*My*Mz;
+  int   NDomains    = omp_get_max_threads();
+  int * DomainFirst = malloc((NDomains+1)*sizeof(int));
+
+  double Imbalance = Compute_Domains(Positions, Neighbors, ListHead, List, type1, NDomains, DomainFirst);
+
+  // The domains are not tied to the thread numbers, so all of them are done
+  // whatever the number of threads the region actually gets
+  #pragma omp parallel for schedule(dynamic,1)
+  for (int d=0;d<NDomains;d++)
+  {
+
+    // Local slot of each cell of the domain and its halo (-1 if not copied)
+    int * Slot   = malloc(NCells*sizeof(int));
+    int * Cells  = malloc(NCells*sizeof(int));
+    int   NLocal = 0;
+    for (int cell=0;cell<NCells;cell++)
+      Slot[cell] = -1;
+    for (int cell=DomainFirst[d];cell<DomainFirst[d+1];cell++)
+    {
+      for (int k=0;k<27;k++)
+      {
+        int ncell = gsl_matrix_get(Neighbors,cell,k);
+        if (Slot[ncell] < 0)
+        {
+          Slot[ncell]     = NLocal;
+          Cells[NLocal++] = ncell;
+        }
+      }
+    }
+
+    // Pack the particles of the local cells (in the order of the linked list)
+    int * First = malloc((NLocal+1)*sizeof(int));
+    First[0] = 0;
+    for (int l=0;l<NLocal;l++)
+    {
+      int n = 0;
+      int j = gsl_vector_get(ListHead,Cells[l]);
+      while (j >= 0)
+      {
+        n++;
+        j = gsl_vector_get(List,j);
+      }
+      First[l+1] = First[l] + n;
+    }
+
+    int      NPacked = First[NLocal];
+    int    * Row     = malloc(NPacked*sizeof(int));
+    int    * Type    = malloc(NPacked*sizeof(int));
+    real   * R       = malloc(3*NPacked*sizeof(real));
+    for (int l=0;l<NLocal;l++)
+    {
+      int k = First[l];
+      int j = gsl_vector_get(ListHead,Cells[l]);
+      while (j >= 0)
+      {
+        Row[k]     = j;
+        Type[k]    = (int) gsl_matrix_get(Positions,j,0);
+        R[3*k]     = gsl_matrix_get(Positions,j,1);
+        R[3*k+1]   = gsl_matrix_get(Positions,j,2);
+        R[3*k+2]   = gsl_matrix_get(Positions,j,3);
+        k++;
+        j = gsl_vector_get(List,j);
+      }
+    }
+
+    // Forces on the particles owned by the domain
+    for (int cell=DomainFirst[d];cell<DomainFirst[d+1];cell++)
+    {
+      int l = Slot[cell];
+      for (int a=First[l];a<First[l+1];a++)
+      {
+        int ti = Type[a];
+        if (!Visited(ti, type1))
+          continue;
+        int i  = Row[a];
+
+        gsl_vector_view vi = gsl_matrix_row(Velocities, i);
+        gsl_vector_set(Kinetic,i,KineticEnergy(&vi.vector, ti));
+
+        double fi[3] = {0.0, 0.0, 0.0};
+        double ei    = 0.0;
+
+        int UseGrid = ((Grid != NULL) && IsOfType(ti, type1));
+        if (UseGrid)
+          ei = InterpolateWallGrid(Grid, ti, R[3*a], R[3*a+1], R[3*a+2], fi);
+
+        const struct PairParameters * row = PairTable + ti*(NTypes+1);
+
+        for (int k=0;k<27;k++)
+        {
+          int ln = Slot[(int) gsl_matrix_get(Neighbors,cell,k)];
+          for (int b=First[ln];b<First[ln+1];b++)
+          {
+            int tj = Type[b];
+            if (UseGrid && IsOfType(tj, type2))
+              continue;
+
+            real deltax  = R[3*a]   - R[3*b];
+                 deltax -= Lx*round(deltax/Lx);
+            real deltay  = R[3*a+1] - R[3*b+1];
+                 deltay -= Ly*round(deltay/Ly);
+            real deltaz  = R[3*a+2] - R[3*b+2];
+                 deltaz -= Lz*round(deltaz/Lz);
+            real r2      = deltax*deltax + deltay*deltay + deltaz*deltaz;
+
+            const struct PairParameters * pair = row + tj;
+            if ((r2 == 0) || (r2 > pair->rcut2))
+              continue;
+
+            // 1.0 if the force acts on this pair (see cg.h), 0.0 otherwise
+            double filter = (((type1 == 0)&&(type2 == 0)) || (IsOfType(ti, type1)&&IsOfType(tj, type2)));
+
+            double ff;
+            if (AllPairsLJ)
+            {
+              real ffr;
+              ei += LJ_PairReal(pair, r2, &ffr);
+              ff  = ffr;
+            }
+            else
+              ei += pair->Style(pair, r2, &ff);
+            fi[0] += filter*ff*deltax;
+            fi[1] += filter*ff*deltay;
+            fi[2] += filter*ff*deltaz;
+          }
+        }
+
+        Forces->data[i*Forces->tda + 0] = fi[0];
+        Forces->data[i*Forces->tda + 1] = fi[1];
+        Forces->data[i*Forces->tda + 2] = fi[2];
+        Energy->data[i*Energy->stride]  = ei;
+      }
+    }
+
+    free(Slot);
+    free(Cells);
+    free(First);
+    free(Row);
+    free(Type);
+    free(R);
+  }
+
+  free(DomainFirst);
+
+  return Imbalance;
+}
@@ -259,6 +259,134 @@ void PrintComputingOptions(void)
   #else
     printf("false\n");
   #endif
+
+  printf("\tPeculiar kinetic stress and temperature:\t");
+  #if __PECULIAR_VELOCITIES__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tMethod of planes (P_xz, P_yz, P_zz):\t\t");
+  #if __COMPUTE_MOP__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tMesoscopic heat flux:\t\t\t\t");
+  #if __COMPUTE_HEAT_FLUX__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tTime correlations of the meso fields:\t\t");
+  #if __COMPUTE_CORRELATIONS__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tCovariance matrices of the meso fields:\t\t");
+  #if __COMPUTE_COVARIANCE__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tPOD modes of the meso fields:\t\t\t");
+  #if __COMPUTE_POD__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tMean squared displacement and VACF:\t\t");
+  #if __COMPUTE_MULTIPLE_TAU__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tStructure factor of the layers:\t\t");
+  #if __COMPUTE_LAYER_SK__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tRadial distribution functions:\t\t\t");
+  #if __COMPUTE_RDF__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tForces of the fluid on the walls:\t\t");
+  #if __COMPUTE_WALL_FORCES__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tSpatial (Morton) order of the particles:\t");
+  #if __SPATIAL_ORDER__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tTabulated wall potential:\t\t\t");
+  #if __WALL_GRID__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tDomain decomposition of the forces:\t\t");
+  #if __DOMAIN_DECOMPOSITION__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tSingle precision force kernels:\t\t");
+  #if __SINGLE_PRECISION__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tCluster-pair force engine:\t\t\t");
+  #if __CLUSTER_PAIRS__
+    printf("true (%d particles per cluster)\n", ClusterSize);
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tShape functions of the nodes:\t\t\t");
+  #if NodeBasis == CubicBasis
+    printf("cubic B-splines\n");
+  #elif NodeBasis == QuadraticBasis
+    printf("quadratic B-splines\n");
+  #else
+    printf("linear\n");
+  #endif
+
+  printf("\tMass matrix projection of the profiles:\t");
+  #if __MASS_MATRIX__
+    printf("true\n");
+  #else
+    printf("false\n");
+  #endif
+
+  printf("\tMesoscopic grid (x, y, z):\t\t\t");
+  #if __MESO_GRID__
+    printf("true (%d x %d x %d nodes)\n", GridNx, GridNy, NNodes);
+  #else
+    printf("false\n");
+  #endif
 }
 
 void PrintScalarWithIndex(int Step, double Value, FILE*fileptr)
@@ -12,105 +12,187 @@
  */
 #include "cg.h"
 
+// The groups of AtomGroups are copied to Groups->Group. The index lists of all
+// the groups are concatenated in Index, whose size grows as needed (a particle
+// may belong to several groups)
 
-
-double Compute_Macro(gsl_vector * Micro, gsl_matrix * Positions, int type, char *str)
+void AllocGroups(struct GroupList * Groups, char * basename)
 {
-    double Macro = 0.0;
-    for(int i=0;i<NParticles;i++)
+    struct AtomGroup Defs[] = AtomGroups;
+    char str[200];
+
+    Groups->NGroups  = sizeof(Defs) / sizeof(Defs[0]);
+    Groups->Group    = malloc(Groups->NGroups*sizeof(struct AtomGroup));
+    Groups->First    = calloc(Groups->NGroups+1, sizeof(int));
+    Groups->Size     = NParticles;
+    Groups->Index    = malloc(Groups->Size*sizeof(int));
+    Groups->Macro    = calloc(Groups->NGroups*MacroValues, sizeof(double));
+    Groups->oFile    = calloc(MacroFiles*Groups->NGroups, sizeof(FILE *));
+
+    for (int g=0;g<Groups->NGroups;g++)
     {
-        if ((int)gsl_matrix_get (Positions, i, 0) == type)
+        if ((Defs[g].Type < 0) || (Defs[g].Type > FluidType))
         {
-            if (strcmp(str,"top") == 0)
-            {
-                if (gsl_matrix_get(Positions,i,3) >= Lz/2.0)
-                {
-                    //printf("Particle %d at %f >= %f\n", i, gsl_matrix_get(Positions,i,3),Lz/2.0);
-                    Macro += gsl_vector_get(Micro, i);
-                }
-            }
-            else if (strcmp(str,"bottom") == 0)
-            {
-                if (gsl_matrix_get(Positions,i,3) < Lz/2.0)
-                {
-                   // printf("Particle %d at %f < %f\n", i, gsl_matrix_get(Positions,i,3),Lz/2.0);
-                    Macro += gsl_vector_get(Micro, i);
-                }
-            }
-            else
-            {
-                    Macro += gsl_vector_get(Micro, i);
-            }
-    
+            PrintMsg("Error in AtomGroups: atom type out of range. Exiting now...");
+            printf("\tGroup %s has type %d (NTypes = %d)\n", Defs[g].Name, Defs[g].Type, NTypes);
+            exit(EXIT_FAILURE);
         }
+        Groups->Group[g] = Defs[g];
+
+        FILE ** oFile = Groups->oFile + g*MacroFiles;
+
+        #if __COMPUTE_MACRO_ENERGY__
+            sprintf(str, "./output/%s.MacroEnergy%s.dat", basename, Defs[g].Name);
+            oFile[0] = fopen(str, "w");
+        #endif
+        #if __COMPUTE_MACRO_MOMENTUM__
+            sprintf(str, "./output/%s.MacroMomentum%s.dat", basename, Defs[g].Name);
+            oFile[1] = fopen(str, "w");
+        #endif
+        #if __COMPUTE_CENTER_OF_MASS__
+            sprintf(str, "./output/%s.CenterOfMass%s.dat", basename, Defs[g].Name);
+            oFile[2] = fopen(str, "w");
+        #endif
+        #if __COMPUTE_WALL_FORCES__
+            sprintf(str, "./output/%s.MacroForce%s.dat", basename, Defs[g].Name);
+            oFile[3] = fopen(str, "w");
+            sprintf(str, "./output/%s.MacroTorque%s.dat", basename, Defs[g].Name);
+            oFile[4] = fopen(str, "w");
+            sprintf(str, "./output/%s.MacroFluidEnergy%s.dat", basename, Defs[g].Name);
+            oFile[5] = fopen(str, "w");
+        #endif
     }
-    return Macro;
 }
 
+void FreeGroups(struct GroupList * Groups)
+{
+    for (int f=0;f<MacroFiles*Groups->NGroups;f++)
+        if (Groups->oFile[f] != NULL)
+            fclose(Groups->oFile[f]);
 
-void Compute_CenterOfMass(gsl_matrix * Positions, int type, char *str, gsl_vector * CenterOfMass)
+    free(Groups->Group);
+    free(Groups->First);
+    free(Groups->Index);
+    free(Groups->Macro);
+    free(Groups->oFile);
+}
+
+void Compute_Groups(gsl_matrix * Positions, struct TypeList * Types, struct Ordering * Order,
+                    struct GroupList * Groups)
 {
-    gsl_vector_set_zero(CenterOfMass);
-    gsl_vector * Position = gsl_vector_calloc(4);
-    double TotalMass = 0.0;
-    for(int i=0;i<NParticles;i++)
+    int n = 0;
+
+    for (int g=0;g<Groups->NGroups;g++)
     {
-        if ((int)gsl_matrix_get (Positions, i, 0) == type)
+        struct AtomGroup * G = Groups->Group + g;
+
+        // Only the atoms of the type of the group are tested
+        int Needed = n + Types->Last[G->Type] - Types->First[G->Type];
+        if (Needed > Groups->Size)
         {
-            if (strcmp(str,"top") == 0)
-            {
-                if (gsl_matrix_get(Positions,i,3) >= Lz/2.0)
-                {
-                    gsl_matrix_get_row(Position, Positions, i);
-                    if ((int)gsl_matrix_get (Positions, i, 0) == 1)
-                    {
-                        gsl_vector_scale(Position , m1);
-                        TotalMass += m1;
-                    }
-                    else 
-                    {
-                        gsl_vector_scale(Position , m2);
-                        TotalMass += m2;
-                    }
-
-                    gsl_vector_add(CenterOfMass, Position);
-                }
-            }
-            else if (strcmp(str, "bottom") == 0)
-            {
-                if (gsl_matrix_get(Positions,i,3) < Lz/2.0)
-                {
-                    gsl_matrix_get_row(Position, Positions, i);
-                    if ((int)gsl_matrix_get (Positions, i, 0) == 1)
-                    {
-                        gsl_vector_scale(Position , m1);
-                        TotalMass += m1;
-                    }
-                    else 
-                    {
-                        gsl_vector_scale(Position , m2);
-                        TotalMass += m2;
-                    }
-                    gsl_vector_add(CenterOfMass, Position);
-                }
-            }
-            else
+            Groups->Size  = Needed;
+            Groups->Index = realloc(Groups->Index, Groups->Size*sizeof(int));
+        }
+
+        Groups->First[g] = n;
+        for (int k=Types->First[G->Type];k<Types->Last[G->Type];k++)
+        {
+            int    i  = Types->Index[k];
+            int    id = Order->Id[i];
+            double z  = gsl_matrix_get(Positions,i,3);
+
+            if ((z >= G->ZMin) && (z < G->ZMax) && (id >= G->IdMin) && (id < G->IdMax)
+                && GroupRegion(g, gsl_matrix_get(Positions,i,1), gsl_matrix_get(Positions,i,2), z))
+                Groups->Index[n++] = i;
+        }
+    }
+    Groups->First[Groups->NGroups] = n;
+}
+
+void Compute_Macro(gsl_matrix * Positions, gsl_vector * Energy, gsl_matrix * Momentum,
+                   gsl_matrix * Cross, struct GroupList * Groups)
+{
+    // All the quantities of a group in a single pass over its atoms
+    for (int g=0;g<Groups->NGroups;g++)
+    {
+        double * Macro = Groups->Macro + g*MacroValues;
+        for (int v=0;v<MacroValues;v++)
+            Macro[v] = 0.0;
+
+        for (int k=Groups->First[g];k<Groups->First[g+1];k++)
+        {
+            int    i    = Groups->Index[k];
+            double mass = MassTable[(int) gsl_matrix_get(Positions,i,0)];
+
+            Macro[0] += gsl_vector_get(Energy,i);
+            for (int a=0;a<3;a++)
+                Macro[1+a] += gsl_matrix_get(Momentum,i,a);
+            Macro[4] += mass;
+            for (int c=0;c<4;c++)
+                Macro[5+c] += mass*gsl_matrix_get(Positions,i,c);
+
+            // Force, r x f and energy of the interaction with the fluid
+            if (Cross != NULL)
             {
-                gsl_matrix_get_row(Position, Positions, i);
-                if ((int)gsl_matrix_get (Positions, i, 0) == 1)
+                double r[3], f[3];
+                for (int a=0;a<3;a++)
                 {
-                    gsl_vector_scale(Position , m1);
-                    TotalMass += m1;
+                    r[a] = gsl_matrix_get(Positions,i,1+a);
+                    f[a] = gsl_matrix_get(Cross,i,a);
+                    Macro[9+a] += f[a];
                 }
-                else 
-                {
-                    gsl_vector_scale(Position , m2);
-                    TotalMass += m2;
-                }
-                gsl_vector_add(CenterOfMass, Position);
+                Macro[12] += r[1]*f[2] - r[2]*f[1];
+                Macro[13] += r[2]*f[0] - r[0]*f[2];
+                Macro[14] += r[0]*f[1] - r[1]*f[0];
+                Macro[15] += gsl_matrix_get(Cross,i,3);
             }
         }
     }
-    gsl_vector_free(Position);
-    gsl_vector_scale(CenterOfMass, 1.0 / TotalMass);
+}
+
+void PrintMacro(int Step, struct GroupList * Groups)
+{
+    for (int g=0;g<Groups->NGroups;g++)
+    {
+        double * Macro = Groups->Macro + g*MacroValues;
+        FILE  ** oFile = Groups->oFile + g*MacroFiles;
+        double   iMass = (Macro[4] > 0.0) ? 1.0/Macro[4] : 0.0;
+
+        if (oFile[0] != NULL)
+            PrintScalarWithIndex(Step, Macro[0], oFile[0]);
+
+        if (oFile[1] != NULL)
+        {
+            gsl_vector_view Momentum = gsl_vector_view_array(Macro+1, 3);
+            PrintInfo(Step, &Momentum.vector, oFile[1]);
+        }
+
+        if (oFile[2] != NULL)
+        {
+            // Mass weighted mean of the rows of Positions (type x y z)
+            double CenterOfMass[4];
+            for (int c=0;c<4;c++)
+                CenterOfMass[c] = Macro[5+c]*iMass;
+            gsl_vector_view Center = gsl_vector_view_array(CenterOfMass, 4);
+            PrintInfo(Step, &Center.vector, oFile[2]);
+        }
+
+        if (oFile[3] != NULL)
+        {
+            gsl_vector_view Force = gsl_vector_view_array(Macro+9, 3);
+            PrintInfo(Step, &Force.vector, oFile[3]);
+
+            // Torque about the center of mass:  sum (r - R) x f = sum r x f - R x F
+            double R[3], Torque[3];
+            for (int a=0;a<3;a++)
+                R[a] = Macro[6+a]*iMass;
+            Torque[0] = Macro[12] - (R[1]*Macro[11] - R[2]*Macro[10]);
+            Torque[1] = Macro[13] - (R[2]*Macro[9]  - R[0]*Macro[11]);
+            Torque[2] = Macro[14] - (R[0]*Macro[10] - R[1]*Macro[9]);
+            gsl_vector_view Moment = gsl_vector_view_array(Torque, 3);
+            PrintInfo(Step, &Moment.vector, oFile[4]);
+
+            PrintScalarWithIndex(Step, Macro[15], oFile[5]);
+        }
+    }
 }
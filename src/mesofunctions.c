@@ -12,16 +12,139 @@
  */
 #include "cg.h"
 
+struct NodeLattice Lattice;
+
 void Compute_Node_Positions(gsl_vector * z)
 {
-  // Valid only for a regular lattice
-  // TODO: Consider irregular lattices
+  if (strlen(NodeFile) > 0)
+  {
+    // Arbitrary lattice: NNodes increasing positions, the last one at Lz
+    FILE * iFile = fopen(NodeFile, "r");
+    if (!iFile)
+    {
+      PrintMsg("Error reading the node positions. Exiting now...");
+      printf("\tThe node file was: %s\n", NodeFile);
+      exit(EXIT_FAILURE);
+    }
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      double zmu;
+      if (fscanf(iFile, "%lf", &zmu) != 1)
+      {
+        PrintMsg("Error reading the node positions: less than NNodes nodes. Exiting now...");
+        exit(EXIT_FAILURE);
+      }
+      gsl_vector_set(z,mu,zmu);
+    }
+    fclose(iFile);
+  }
+  else
+  {
+    // Regular lattice (NodeStretch = 0), or finer near z = 0 and z = Lz
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      double s = (double) (mu+1)/NNodes;
+      gsl_vector_set(z,mu,(double) (mu+1)*Lz/NNodes - Lz*NodeStretch*sin(2*M_PI*s)/(2*M_PI));
+    }
+  }
+
+  // The last node is the periodic image of z = 0
+  if (fabs(gsl_vector_get(z,NNodes-1) - Lz) > 1e-8*Lz)
+  {
+    PrintMsg("Error in the node lattice: the last node must be at Lz. Exiting now...");
+    exit(EXIT_FAILURE);
+  }
+  gsl_vector_set(z,NNodes-1,Lz);
+
+  // Width of the elements (h[mu] is the width of the element at the left of mu)
+  // and volume of the nodes (Lx Ly times the integral of the shape function)
+  double hmin = Lz;
   for (int mu=0;mu<NNodes;mu++)
-    gsl_vector_set(z,mu,(double) (mu+1)*Lz/NNodes);
+  {
+    Lattice.h[mu] = gsl_vector_get(z,mu) - ((mu == 0) ? 0.0 : gsl_vector_get(z,mu-1));
+    if (Lattice.h[mu] <= 0.0)
+    {
+      PrintMsg("Error in the node lattice: nodes must be increasing and above 0. Exiting now...");
+      printf("\tNode %d at z = %f\n", mu, gsl_vector_get(z,mu));
+      exit(EXIT_FAILURE);
+    }
+    hmin = min(hmin, Lattice.h[mu]);
+  }
+  Compute_Basis_Volumes();
+  #if __MASS_MATRIX__
+    Compute_Basis_MassMatrix();
+  #endif
+
+  // Lookup grid: bins not wider than the narrowest element, so that each bin
+  // holds at most one node. Lookup[b] is the first node above the bin start
+  Lattice.NLookup = max(NNodes, ceil(2.0*Lz/hmin));
+  Lattice.iDelta  = Lattice.NLookup/Lz;
+  Lattice.Lookup  = malloc(Lattice.NLookup*sizeof(int));
+  int mu = 0;
+  for (int b=0;b<Lattice.NLookup;b++)
+  {
+    while (gsl_vector_get(z,mu) <= b/Lattice.iDelta)
+      mu++;
+    Lattice.Lookup[b] = mu;
+  }
 }
 
-void Compute_Meso_Density(gsl_matrix * Micro, gsl_vector * z, int type, 
-                          gsl_vector * n)
+void FreeNodeLattice(void)
+{
+  free(Lattice.Lookup);
+  #if __MASS_MATRIX__
+    FreeMassMatrix(&NodeMass);
+  #endif
+}
+
+int Node_Right(gsl_vector * z, double zi)
+{
+  if (zi >= Lz)
+    return NNodes;
+  if (zi < 0.0)
+    return 0;
+  // zi*iDelta may round up to NLookup for zi just below Lz
+  int b  = (int) (zi*Lattice.iDelta);
+  int mu = Lattice.Lookup[(b < Lattice.NLookup) ? b : Lattice.NLookup-1];
+  return mu + (zi >= z->data[mu*z->stride]);
+}
+
+int Node_Weights(gsl_vector * z, double zi, int * muLeft, double * wLeft, double * wRight)
+{
+  int muRight = Node_Right(z, zi);
+
+  // zi = Lz belongs to the last node only
+  if (muRight == NNodes)
+  {
+    *muLeft = NNodes-1;
+    *wLeft  = 0.0;
+    *wRight = 1.0;
+    return NNodes-1;
+  }
+
+  // PBC: the node at the left of the first one is the last one (z = Lz = 0)
+  double zLeft = (muRight == 0) ? 0.0 : gsl_vector_get(z,muRight-1);
+  *muLeft = (muRight == 0) ? NNodes-1 : muRight-1;
+  *wRight = (zi - zLeft)/Lattice.h[muRight];
+  *wLeft  = (gsl_vector_get(z,muRight) - zi)/Lattice.h[muRight];
+  return muRight;
+}
+
+int Element_Of(gsl_vector * z, double zi)
+{
+  // Element mu spans from node mu to node mu+1. PBC: the element below the
+  // first node is the last one
+  int mu = Node_Right(z, zi) - 1;
+  return (mu == -1) ? NNodes-1 : mu;
+}
+
+double Element_Volume(int mu)
+{
+  return Lx*Ly*Lattice.h[(mu+1)%NNodes];
+}
+
+void Compute_Meso_Density(gsl_matrix * Micro, struct TypeList * Types, gsl_vector * z, 
+                          int type, gsl_vector * n)
 {
 
   // RESET vector
@@ -29,263 +152,300 @@ void Compute_Meso_Density(gsl_matrix * Micro, gsl_vector * z, int type,
 
   // Valid for PBC,  this function obtains the  density of a slab of volume Lx *
   //  Ly *  dz The  slab is  build as  a  finite  element  based  on  a Delaunay
-  // tessellation
-  double dv = ((float) Lx * Ly * Lz) / NNodes;
-  double dz = ((float) Lz) / NNodes;
-  double zi;
-  int muRight, muLeft;
+  // tessellation (with the shape functions of NodeBasis)
 
-  for (int i=0;i<NParticles;i++)
-  {
-    zi = gsl_matrix_get(Micro,i,3);
-    if (((int) gsl_matrix_get(Micro,i,0) == 0)||((int) gsl_matrix_get(Micro,i,0) == type)) 
-    {
-      muRight = (int) floor(zi*NNodes/Lz);        
-      muLeft  = muRight-1;
-      if (muLeft < 0) 
-      {
-        n->data[muRight*n->stride] += zi/dz;
-        n->data[(NNodes-1)*n->stride] += (gsl_vector_get(z,muRight) - zi)/dz;
-      } 
-      else if (muRight == NNodes)
-      {
-        n->data[(NNodes-1)*n->stride] += 1.0;
-      }
-      else 
-      {
-        n->data[muRight*n->stride] += (zi -  gsl_vector_get(z,muLeft))/dz;
-        n->data[ muLeft*n->stride] += (gsl_vector_get(z,muRight) - zi)/dz;
-      }
-    }
-  }
-  gsl_vector_scale(n,1.0/dv);
+  // Loop only over the particles of the given type (all of them if type == 0)
+  Basis_Scatter(Micro, Types->Index + Types->First[type], Types->Last[type]-Types->First[type],
+                z, NULL, 0, n->data, n->stride);
+  Basis_Normalize(n->data, n->stride);
 }
 
 void Compute_Meso_Force(gsl_matrix * Positions, gsl_matrix * Forces, 
                         gsl_vector * z, gsl_matrix * MesoForce)
 {
-  double zi, fx, fy, fz;
-  int muRight, muLeft;
-  double dv = ((float) Lx * Ly * Lz) / NNodes;
-  double dz = ((float) Lz) / NNodes;
-
-  for (int i=0;i<NParticles;i++)
-  {
-    zi      = gsl_matrix_get(Positions,i,3);
-    fx      = gsl_matrix_get(Forces,i,0);
-    fy      = gsl_matrix_get(Forces,i,1);
-    fz      = gsl_matrix_get(Forces,i,2);
-    
-    muRight = (int) floor(zi*NNodes/Lz);        
-    muLeft  = muRight-1;
-    
-    if (muLeft < 0) 
-    {
-      MesoForce->data[   muRight*MesoForce->tda+0] += fx * zi/dz;
-      MesoForce->data[(NNodes-1)*MesoForce->tda+0] += fx * (gsl_vector_get(z,muRight) - zi)/dz;
-      MesoForce->data[   muRight*MesoForce->tda+1] += fy * zi/dz;
-      MesoForce->data[(NNodes-1)*MesoForce->tda+1] += fy * (gsl_vector_get(z,muRight) - zi)/dz;
-      MesoForce->data[   muRight*MesoForce->tda+2] += fz * zi/dz;
-      MesoForce->data[(NNodes-1)*MesoForce->tda+2] += fz * (gsl_vector_get(z,muRight) - zi)/dz;
-    } 
-    else if (muRight == NNodes)
-    {
-      MesoForce->data[(NNodes-1)*MesoForce->tda+0] += fx;
-      MesoForce->data[(NNodes-1)*MesoForce->tda+1] += fy;
-      MesoForce->data[(NNodes-1)*MesoForce->tda+2] += fz;
-    }
-    else 
-    {
-      MesoForce->data[muRight*MesoForce->tda+0] += fx * (zi -  gsl_vector_get(z,muLeft))/dz;
-      MesoForce->data[ muLeft*MesoForce->tda+0] += fx * (gsl_vector_get(z,muRight) - zi)/dz;
-      MesoForce->data[muRight*MesoForce->tda+1] += fy * (zi -  gsl_vector_get(z,muLeft))/dz;
-      MesoForce->data[ muLeft*MesoForce->tda+1] += fy * (gsl_vector_get(z,muRight) - zi)/dz;
-      MesoForce->data[muRight*MesoForce->tda+2] += fz * (zi -  gsl_vector_get(z,muLeft))/dz;
-      MesoForce->data[ muLeft*MesoForce->tda+2] += fz * (gsl_vector_get(z,muRight) - zi)/dz;
-    }
-  }
-  gsl_matrix_scale(MesoForce,1.0/dv);
+  // RESET matrix
+  gsl_matrix_set_zero(MesoForce);
+
+  for (int d=0;d<3;d++)
+    Basis_Scatter(Positions, NULL, NParticles, z, Forces->data + d, Forces->tda,
+                  MesoForce->data + d, MesoForce->tda);
+  for (int d=0;d<3;d++)
+    Basis_Normalize(MesoForce->data + d, MesoForce->tda);
 }
 
 void Compute_Meso_Sigma1 (gsl_matrix * Positions, gsl_matrix * Velocities, 
-                          gsl_matrix * MesoSigma1)
+                          struct TypeList * Types, gsl_matrix * MesoSigma1,
+                          gsl_vector * z)
 {
   int mu = 0;
   double mass = 0.0;
-  double dv = ((float) Lx * Ly * Lz) / NNodes;
   
   gsl_matrix_set_zero(MesoSigma1);
   
-  // Loop over all i-particles
-  for (int i=0;i<NParticles;i++)
+  // Loop only over fluid i-particles. Wall particles do not contribute to the
+  // stress tensor
+  for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+  {
+    int i = Types->Index[k];
+
+    // Obtain the bin (element) to where the i-particle belongs to
+    mu = Element_Of(z, gsl_matrix_get(Positions,i,3));
+
+    mass = MassTable[(int) gsl_matrix_get(Positions,i,0)];
+
+    double * sigma1 = malloc(9*sizeof(double));
+
+    double vx = gsl_matrix_get(Velocities,i,0);
+    double vy = gsl_matrix_get(Velocities,i,1);
+    double vz = gsl_matrix_get(Velocities,i,2);
+
+    sigma1[0] = vx * vx;
+    sigma1[1] = vx * vy;
+    sigma1[2] = vx * vz;
+    sigma1[3] = vy * vx;
+    sigma1[4] = vy * vy;
+    sigma1[5] = vy * vz;
+    sigma1[6] = vz * vx;
+    sigma1[7] = vz * vy;
+    sigma1[8] = vz * vz;
+   
+    for (int j=0;j<9;j++)
+      MesoSigma1->data[mu*MesoSigma1->tda+j] += mass * sigma1[j];
+
+    free(sigma1);
+  }
+  for (int mu=0;mu<NNodes;mu++)
   {
-    // Consider only type2 (fluid) particles 
-    if ((int) gsl_matrix_get(Positions,i,0) == 2)
+    gsl_vector_view row = gsl_matrix_row(MesoSigma1,mu);
+    gsl_vector_scale(&row.vector,1.0/Element_Volume(mu));
+  }
+}
+
+void Compute_Meso_Peculiar (gsl_matrix * Positions, gsl_matrix * Velocities,
+                            struct TypeList * Types, gsl_matrix * MesoSigma1,
+                            gsl_vector * MesoTemp, gsl_vector * z)
+{
+  // Moments of the velocities in each element (stress) and with the weights
+  // of each node (temperature):  sum m, sum m v, sum m v v  (and sum w, sum w^2)
+  double * M  = calloc(NNodes, sizeof(double));
+  double * P  = calloc(3*NNodes, sizeof(double));
+  double * S  = calloc(9*NNodes, sizeof(double));
+  double * W  = calloc(NNodes, sizeof(double));
+  double * W2 = calloc(NNodes, sizeof(double));
+  double * WM = calloc(NNodes, sizeof(double));
+  double * WP = calloc(3*NNodes, sizeof(double));
+  double * WK = calloc(NNodes, sizeof(double));
+
+  for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+  {
+    int    i    = Types->Index[k];
+    double zi   = gsl_matrix_get(Positions,i,3);
+    double mass = MassTable[(int) gsl_matrix_get(Positions,i,0)];
+    double v[3];
+    for (int a=0;a<3;a++)
+      v[a] = gsl_matrix_get(Velocities,i,a);
+    double v2 = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+
+    int mu = Element_Of(z, zi);
+    M[mu] += mass;
+    for (int a=0;a<3;a++)
+    {
+      P[3*mu+a] += mass*v[a];
+      for (int b=0;b<3;b++)
+        S[9*mu+3*a+b] += mass*v[a]*v[b];
+    }
+
+    double w[BasisSupport];
+    int    First = Basis_Weights(z, zi, w);
+    for (int s=0;s<BasisSupport;s++)
     {
-      // Obtain the bin to where the i-particle belongs to
-      mu = floor(gsl_matrix_get(Positions,i,3)*NNodes/Lz) - 1;
-      // PBC: If mu == -1, the particle belongs to the upper bin
-      ( mu == -1 ) ? mu = NNodes-1 : mu ;
-
-      // mass = ( gsl_matrix_get(Positions,i,0) == 1 ? m1 : m2 );
-      // If type of atom == 1 then it is a wall particle, so it does not contribute to the
-      // stress tensor
-      mass = ( (int) gsl_matrix_get(Positions,i,0) == 1 ? 0.0 : m2 );
-
-      double * sigma1 = malloc(9*sizeof(double));
-
-      double vx = gsl_matrix_get(Velocities,i,0);
-      double vy = gsl_matrix_get(Velocities,i,1);
-      double vz = gsl_matrix_get(Velocities,i,2);
-
-      sigma1[0] = vx * vx;
-      sigma1[1] = vx * vy;
-      sigma1[2] = vx * vz;
-      sigma1[3] = vy * vx;
-      sigma1[4] = vy * vy;
-      sigma1[5] = vy * vz;
-      sigma1[6] = vz * vx;
-      sigma1[7] = vz * vy;
-      sigma1[8] = vz * vz;
-     
-      for (int j=0;j<9;j++)
-        MesoSigma1->data[mu*MesoSigma1->tda+j] += mass * sigma1[j];
-
-      free(sigma1);
+      int nu = (First+s) % NNodes;
+      W[nu]  += w[s];
+      W2[nu] += w[s]*w[s];
+      WM[nu] += w[s]*mass;
+      WK[nu] += w[s]*mass*v2;
+      for (int a=0;a<3;a++)
+        WP[3*nu+a] += w[s]*mass*v[a];
     }
   }
-  gsl_matrix_scale(MesoSigma1,1.0/dv);
+
+  // Peculiar stress:  sum m (v-u)(v-u) = sum m v v - (sum m v)(sum m v) / sum m
+  if (MesoSigma1 != NULL)
+  {
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      double iM = (M[mu] > 0.0) ? 1.0/M[mu] : 0.0;
+      for (int a=0;a<3;a++)
+        for (int b=0;b<3;b++)
+          gsl_matrix_set(MesoSigma1, mu, 3*a+b, (S[9*mu+3*a+b] - P[3*mu+a]*P[3*mu+b]*iM)/Element_Volume(mu));
+    }
+  }
+
+  // Peculiar temperature. Subtracting the local velocity removes the (weighted)
+  // equivalent of 3 degrees of freedom:  <sum w m (v-u)^2> = 3 T (W - sum w^2 / W)
+  if (MesoTemp != NULL)
+  {
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      double Dof = (W[mu] > 0.0) ? W[mu] - W2[mu]/W[mu] : 0.0;
+      double Pu2 = WP[3*mu]*WP[3*mu] + WP[3*mu+1]*WP[3*mu+1] + WP[3*mu+2]*WP[3*mu+2];
+      double K   = (WM[mu] > 0.0) ? WK[mu] - Pu2/WM[mu] : 0.0;
+      gsl_vector_set(MesoTemp, mu, (Dof > 1e-8) ? K/(3.0*Dof) : 0.0);
+    }
+  }
+
+  free(M);
+  free(P);
+  free(S);
+  free(W);
+  free(W2);
+  free(WM);
+  free(WP);
+  free(WK);
 }
 
-void Compute_Meso_Sigma2 (gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
-                          gsl_vector * List, gsl_matrix * MesoSigma2, gsl_vector * z)
+void Compute_Meso_HeatFlux1 (gsl_matrix * Positions, gsl_matrix * Velocities,
+                             struct TypeList * Types, gsl_vector * Energy,
+                             gsl_vector * Kinetic, gsl_matrix * MesoHeat1,
+                             gsl_vector * z)
+{
+  gsl_matrix_set_zero(MesoHeat1);
+
+  // Energy of particle i: its kinetic energy and half of its pair energies
+  // (Energy adds the whole energy of every pair to both particles)
+  for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+  {
+    int    i  = Types->Index[k];
+    int    mu = Element_Of(z, gsl_matrix_get(Positions,i,3));
+    double ei = gsl_vector_get(Kinetic,i) + 0.5*gsl_vector_get(Energy,i);
+
+    for (int a=0;a<3;a++)
+      MesoHeat1->data[mu*MesoHeat1->tda+a] += ei*gsl_matrix_get(Velocities,i,a);
+  }
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    gsl_vector_view row = gsl_matrix_row(MesoHeat1,mu);
+    gsl_vector_scale(&row.vector,1.0/Element_Volume(mu));
+  }
+}
+
+void Compute_Meso_Sigma2 (gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Neighbors,
+                          gsl_vector * ListHead, gsl_vector * List, struct TypeList * Types,
+                          gsl_matrix * MesoSigma2, gsl_matrix * MesoHeat2, gsl_vector * z)
 {
 
   gsl_matrix_set_zero(MesoSigma2);
+  if (MesoHeat2 != NULL)
+    gsl_matrix_set_zero(MesoHeat2);
 
-  double dv = ((float) Lx * Ly * Lz) / NNodes;
-  
-  #pragma omp parallel num_threads(8)
+  #pragma omp parallel
   {
-    #pragma omp for schedule (static) 
-    // Forall i particles
-    for (int i=0;i<NParticles;i++)
+    // Each thread accumulates in its own copy of the tensors
+    double * Local    = calloc(9*NNodes, sizeof(double));
+    double * Heat     = calloc(3*NNodes, sizeof(double));
+    int    * Verlet   = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz) );
+    int    * Element  = malloc((NNodes+1)*sizeof(int));
+    double * Fraction = malloc((NNodes+1)*sizeof(double));
+
+    #pragma omp for schedule (dynamic,16)
+    // Forall i particles, only for fluid particles
+    for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
     {
-      // Only for fluid (type 2) particle
-      if ((int) gsl_matrix_get(Positions,i,0) == 2)
+      int i = Types->Index[k];
+
+      double zi = gsl_matrix_get(Positions,i,3);
+
+      // Find the cell to which the particle i belongs and all its neighboring cells
+      int iCell = FindParticle(Positions,i);
+      gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
+      
+      // Find the neighbors of particle i
+      int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+      
+      // Forall Verlet[j] neighboring particles. Each pair is visited once (i <
+      // j), so the factor 1/2 is not needed
+      for (int jj=0;jj<NNeighbors;jj++)
       {
-        double zi = gsl_matrix_get(Positions,i,3);
-        // Find the bin mu to which the particle i belongs
-        int mu = floor(zi*NNodes/Lz) - 1;
-        // NEVER APPLIED (bc there is no type2 particles in bin NNodes)
-        // Checkpoint
-        // if (mu == -1) 
-        //   printf("ERROR! Fluid particle %d in bin %d!\n", i, mu);
-        ( mu == -1 ) ? mu = NNodes-1 : mu ;
-
-        // Find the cell to which the particle i belongs and all its neighboring cells
-        int iCell = FindParticle(Positions,i);
-        gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
-        
-        // Find the neighbors of particle i
-        int * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz) );
-        int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
-        
-        // Forall Verlet[j] neighboring particles
-        for (int j=0;j<NNeighbors;j++)
+        int j = Verlet[jj];
+
+        // Only for fluid particles
+        if ((j <= i) || !IsOfType((int) gsl_matrix_get(Positions,j,0), FluidType))
+          continue;
+
+        // Compute only the force between fluid particles (fluid-fluid
+        // interaction)
+        double fij[3], rij[3], sigma2[9];
+        Compute_Force_ij (Positions, i, j, FluidType, FluidType, fij);
+
+        rij[0]  = gsl_matrix_get(Positions,i,1) - gsl_matrix_get(Positions,j,1);
+        rij[0] -= Lx*round(rij[0]/Lx);
+        rij[1]  = gsl_matrix_get(Positions,i,2) - gsl_matrix_get(Positions,j,2);
+        rij[1] -= Ly*round(rij[1]/Ly);
+        rij[2]  = zi - gsl_matrix_get(Positions,j,3);
+        rij[2] -= Lz*round(rij[2]/Lz);
+
+        for (int a=0;a<3;a++)
+          for (int b=0;b<3;b++)
+            sigma2[3*a+b] = rij[a]*fij[b];
+
+        // Virial part of the heat flux: rij times the power of fij on the mean
+        // velocity of the pair,  fij (vi + vj) / 2
+        double q = 0.0;
+        if (MesoHeat2 != NULL)
+          for (int a=0;a<3;a++)
+            q += 0.5*fij[a]*(gsl_matrix_get(Velocities,i,a) + gsl_matrix_get(Velocities,j,a));
+
+        // The bond goes from zi to zi - rij (nearest image of j), and each
+        // element gets the fraction of the bond inside it
+        int NPieces = Bond_Split(z, zi, -rij[2], Element, Fraction);
+        for (int p=0;p<NPieces;p++)
         {
-          // Only for fluid (type 2) particles
-          if ((int) gsl_matrix_get(Positions,Verlet[j],0) == 2)
-          {
-            double zj = gsl_matrix_get(Positions,Verlet[j],3);
-            // Find the bin nu to which the particle Verlet[j] belongs
-            int nu = floor(zj*NNodes/Lz) - 1;
-            // NEVER APPLIED (bc there is no type2 particles in bin NNodes)
-            // Checkpoint
-            // if (nu == -1) 
-            //   printf("ERROR! Fluid particle %d in bin %d!\n", Verlet[j], nu);
-            ( nu == -1 ) ? nu = NNodes-1 : nu ;
-
-            // Compute only the force between  particles of type 2 and particle of
-            // type 2 (fluid-fluid interaction)
-            // This  portion is  redundant,  the program does  not enter  into the
-            // loop for particles different from type 2
-            double * fij = malloc(3*sizeof(double));
-            
-            double eij = Compute_Force_ij (Positions, i, Verlet[j], 2, 2, fij);
-    
-            double * rij = malloc(3*sizeof(double));
-
-            rij[0]  = gsl_matrix_get(Positions,i,1) - gsl_matrix_get(Positions,Verlet[j],1);
-            rij[0] -= Lx*round(rij[0]/Lx);
-            rij[1]  = gsl_matrix_get(Positions,i,2) - gsl_matrix_get(Positions,Verlet[j],2);
-            rij[1] -= Ly*round(rij[1]/Ly);
-            rij[2]  = zi - zj;
-            rij[2] -= Lz*round(rij[2]/Lz);
-
-            double * sigma2 = malloc(9*sizeof(double));
-
-            for (int sigma=((int)min(mu,nu)); sigma<=((int)max(mu,nu));sigma++)
-            {
-              double zsigma = zmuij(z,sigma,zi,zj);
-              sigma2[0] = rij[0]*fij[0]*zsigma;
-              sigma2[1] = rij[0]*fij[1]*zsigma;
-              sigma2[2] = rij[0]*fij[2]*zsigma;
-              sigma2[3] = rij[1]*fij[0]*zsigma;
-              sigma2[4] = rij[1]*fij[1]*zsigma;
-              sigma2[5] = rij[1]*fij[2]*zsigma;
-              sigma2[6] = rij[2]*fij[0]*zsigma;
-              sigma2[7] = rij[2]*fij[1]*zsigma;
-              sigma2[8] = rij[2]*fij[2]*zsigma;
-
-              for (int k=0;k<9;k++)
-                MesoSigma2->data[sigma*MesoSigma2->tda+k] += sigma2[k];
-            }
-            
-            free(fij);
-            free(rij);
-            free(sigma2);
-          }
+          double * s = Local + 9*Element[p];
+          for (int l=0;l<9;l++)
+            s[l] += Fraction[p]*sigma2[l];
+
+          double * h = Heat + 3*Element[p];
+          for (int a=0;a<3;a++)
+            h[a] += Fraction[p]*rij[a]*q;
         }
-        free(Verlet);
       }
     }
+
+    #pragma omp critical
+    {
+      for (int l=0;l<9*NNodes;l++)
+        MesoSigma2->data[(l/9)*MesoSigma2->tda + l%9] += Local[l];
+      if (MesoHeat2 != NULL)
+        for (int l=0;l<3*NNodes;l++)
+          MesoHeat2->data[(l/3)*MesoHeat2->tda + l%3] += Heat[l];
+    }
+
+    free(Local);
+    free(Heat);
+    free(Verlet);
+    free(Element);
+    free(Fraction);
+  }
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    gsl_vector_view row = gsl_matrix_row(MesoSigma2,mu);
+    gsl_vector_scale(&row.vector,1.0/Element_Volume(mu));
+    if (MesoHeat2 != NULL)
+    {
+      gsl_vector_view heat = gsl_matrix_row(MesoHeat2,mu);
+      gsl_vector_scale(&heat.vector,1.0/Element_Volume(mu));
+    }
   }
-  gsl_matrix_scale(MesoSigma2,0.5/dv);
 }
           
 void Compute_Meso_Energy(gsl_matrix * Micro, gsl_vector * MicroEnergy, gsl_vector * z, gsl_vector * MesoEnergy)
 {
-  double dv = ((float) Lx * Ly * Lz) / NNodes;
-  double dz = ((float) Lz) / NNodes;
-  double zi, ei;
-  int muRight, muLeft;
-
   // RESET vector
   gsl_vector_set_zero(MesoEnergy);
 
-  for (int i=0;i<NParticles;i++)
-  {
-    zi      = gsl_matrix_get(Micro,i,3);
-    ei      = gsl_vector_get(MicroEnergy,i);
-    muRight = (int) floor(zi*NNodes/Lz);        
-    muLeft  = muRight-1;
-    if (muLeft < 0) 
-    {
-      MesoEnergy->data[   muRight*MesoEnergy->stride] += ei * zi/dz;
-      MesoEnergy->data[(NNodes-1)*MesoEnergy->stride] += ei * (gsl_vector_get(z,muRight) - zi)/dz;
-    } 
-    else if (muRight == NNodes)
-    {
-      MesoEnergy->data[(NNodes-1)*MesoEnergy->stride] += ei;
-    }
-    else 
-    {
-      MesoEnergy->data[muRight*MesoEnergy->stride] += ei * (zi -  gsl_vector_get(z,muLeft))/dz;
-      MesoEnergy->data[ muLeft*MesoEnergy->stride] += ei * (gsl_vector_get(z,muRight) - zi)/dz;
-    }
-  }
-  gsl_vector_scale(MesoEnergy,1.0/dv);
+  Basis_Scatter(Micro, NULL, NParticles, z, MicroEnergy->data, MicroEnergy->stride,
+                MesoEnergy->data, MesoEnergy->stride);
+  Basis_Normalize(MesoEnergy->data, MesoEnergy->stride);
 }
 
 void Compute_Meso_Temp(gsl_vector * MesoKinetic, gsl_vector * MesoDensity, gsl_vector * MesoTemp)
@@ -352,41 +512,16 @@ void Compute_Meso_Velocity(gsl_matrix * MesoMomentum, gsl_vector * MesoDensity,
   }
 }
           
-void Compute_Meso_Profile(gsl_matrix * Positions, gsl_vector * Micro, gsl_vector * z, gsl_vector * Meso, int type)
+void Compute_Meso_Profile(gsl_matrix * Positions, struct TypeList * Types, gsl_vector * Micro, 
+                          gsl_vector * z, gsl_vector * Meso, int type)
 {
-  double dv = ((float) Lx * Ly * Lz) / NNodes;
-  double dz = ((float) Lz) / NNodes;
-  double zi, ei;
-  int muRight, muLeft;
-
   // RESET vector
   gsl_vector_set_zero(Meso);
 
-  for (int i=0;i<NParticles;i++)
-  {
-    if ((int) gsl_matrix_get(Positions,i,0) == type)
-    {
-      zi      = gsl_matrix_get(Positions,i,3);
-      ei      = gsl_vector_get(Micro,i);
-      muRight = (int) floor(zi*NNodes/Lz);        
-      muLeft  = muRight-1;
-      if (muLeft < 0) 
-      {
-        Meso->data[   muRight*Meso->stride] += ei * zi/dz;
-        Meso->data[(NNodes-1)*Meso->stride] += ei * (gsl_vector_get(z,muRight) - zi)/dz;
-      } 
-      else if (muRight == NNodes)
-      {
-        Meso->data[(NNodes-1)*Meso->stride] += ei;
-      }
-      else 
-      {
-        Meso->data[muRight*Meso->stride] += ei * (zi -  gsl_vector_get(z,muLeft))/dz;
-        Meso->data[ muLeft*Meso->stride] += ei * (gsl_vector_get(z,muRight) - zi)/dz;
-      }
-    }
-  }
-  gsl_vector_scale(Meso,1.0/dv);
+  // Loop only over the particles of the given type
+  Basis_Scatter(Positions, Types->Index + Types->First[type], Types->Last[type]-Types->First[type],
+                z, Micro->data, Micro->stride, Meso->data, Meso->stride);
+  Basis_Normalize(Meso->data, Meso->stride);
 }
         
 void Compute_InternalEnergy(gsl_vector * MesoEnergy, gsl_matrix * MesoMomentum, 
@@ -419,8 +554,9 @@ double zmuij(gsl_vector * z, int mu, double zi, double zj)
 {
  
   double val;
-  double z1 = gsl_vector_get(z,mu);
-  double z2 = gsl_vector_get(z,mu+1);
+  // Bounds of element mu (the last element spans from z = 0 to the first node)
+  double z1 = (mu == NNodes-1) ? 0.0 : gsl_vector_get(z,mu);
+  double z2 = (mu == NNodes-1) ? gsl_vector_get(z,0) : gsl_vector_get(z,mu+1);
 
   if (fabs(zi-zj) <= 1e-10)
   {
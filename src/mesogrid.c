@@ -0,0 +1,513 @@
+/*
+ * Filename   : mesogrid.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 22:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Two and three dimensional mesoscopic grids (tensor product of
+ *              linear elements in x, y and z)
+ *
+ */
+
+#include "cg.h"
+
+// Nodes are the tensor product of GridNx regular nodes in x (at ix*dx), GridNy
+// regular nodes in y and the NNodes nodes of the lattice in z.  With GridNx = 1
+// (or GridNy = 1) the shape functions do not depend on x (or y), so GridNy = 1
+// gives x-z maps and GridNx = GridNy = 1 the usual z profiles.  Node (ix,iy,mu)
+// is stored in (mu*Ny + iy)*Nx + ix.
+//
+// Stresses are cell (element) averages like MesoSigma1 and MesoSigma2:  cell
+// (ix,iy,mu) spans from ix*dx to (ix+1)*dx, from iy*dy to (iy+1)*dy and covers
+// the element mu in z.
+//
+// In z the nodes have the shape functions of NodeBasis (see basis.c). Particles
+// are bucketed by z element, and a particle of element mu only writes in the
+// ElementSpan node layers around it,  so distant elements are scattered in
+// parallel without conflicts.
+
+// Node layers written by the particles of an element. The BasisSupport nodes of
+// a particle start at its element (odd degrees) or, for the quadratic basis,
+// centered at the nearest node, at the element or the one below it
+
+#define ElementSpan (BasisSupport + (NodeBasis+1)%2)
+
+static long GridNode(struct MesoGrid * Grid, int ix, int iy, int mu)
+{
+  return ((long) mu*Grid->Ny + iy)*Grid->Nx + ix;
+}
+
+void AllocMesoGrid(struct MesoGrid * Grid)
+{
+  Grid->Nx     = GridNx;
+  Grid->Ny     = GridNy;
+  Grid->dx     = Lx / GridNx;
+  Grid->dy     = Ly / GridNy;
+  Grid->Size   = (long) GridNx * GridNy * NNodes;
+
+  // Pieces of a bond shorter than Rcut: one more than the planes it can cross
+  // in x, y (at most ceil(Rcut/h)+1 each) and z (the nodes in Rcut, and their
+  // periodic images)
+  Grid->MaxPieces = (int) ceil(Rcut/Grid->dx) + (int) ceil(Rcut/Grid->dy)
+                  + NNodes*((int) floor(Rcut/Lz) + 1) + 3;
+  Grid->NSamples = 0;
+
+  Grid->Particle     = malloc(NParticles*sizeof(int));
+  Grid->ElementFirst = malloc((NNodes+1)*sizeof(int));
+
+  Grid->Density  = AllocArray(Grid->Size,   sizeof(double));
+  Grid->Momentum = AllocArray(3*Grid->Size, sizeof(double));
+  Grid->Energy   = AllocArray(Grid->Size,   sizeof(double));
+  Grid->Kinetic  = AllocArray(Grid->Size,   sizeof(double));
+  Grid->Sigma1   = AllocArray(9*Grid->Size, sizeof(double));
+  Grid->Sigma2   = AllocArray(9*Grid->Size, sizeof(double));
+
+  Grid->DensityAvg  = AllocArray(Grid->Size,   sizeof(double));
+  Grid->MomentumAvg = AllocArray(3*Grid->Size, sizeof(double));
+  Grid->EnergyAvg   = AllocArray(Grid->Size,   sizeof(double));
+  Grid->KineticAvg  = AllocArray(Grid->Size,   sizeof(double));
+  Grid->SigmaAvg    = AllocArray(9*Grid->Size, sizeof(double));
+
+  #if __MASS_MATRIX__
+    Compute_Hat_MassMatrix(&Grid->MassX, Grid->Nx, Grid->dx);
+    Compute_Hat_MassMatrix(&Grid->MassY, Grid->Ny, Grid->dy);
+  #endif
+}
+
+void FreeMesoGrid(struct MesoGrid * Grid)
+{
+  free(Grid->Particle);
+  free(Grid->ElementFirst);
+  free(Grid->Density);
+  free(Grid->Momentum);
+  free(Grid->Energy);
+  free(Grid->Kinetic);
+  free(Grid->Sigma1);
+  free(Grid->Sigma2);
+  free(Grid->DensityAvg);
+  free(Grid->MomentumAvg);
+  free(Grid->EnergyAvg);
+  free(Grid->KineticAvg);
+  free(Grid->SigmaAvg);
+  #if __MASS_MATRIX__
+    FreeMassMatrix(&Grid->MassX);
+    FreeMassMatrix(&Grid->MassY);
+  #endif
+}
+
+void Compute_Element_Bins(gsl_matrix * Positions, struct TypeList * Types, int type,
+                          gsl_vector * z, int * Particle, int * ElementFirst)
+{
+  int * Element = malloc(NParticles*sizeof(int));
+  int * Count   = calloc(NNodes+1, sizeof(int));
+
+  for (int k=Types->First[type];k<Types->Last[type];k++)
+  {
+    int i      = Types->Index[k];
+    Element[i] = Element_Of(z, gsl_matrix_get(Positions,i,3));
+    Count[Element[i]+1]++;
+  }
+
+  // Counting sort of the particles by element
+  for (int mu=0;mu<NNodes;mu++)
+    Count[mu+1] += Count[mu];
+  for (int mu=0;mu<=NNodes;mu++)
+    ElementFirst[mu] = Count[mu];
+  for (int k=Types->First[type];k<Types->Last[type];k++)
+  {
+    int i = Types->Index[k];
+    Particle[Count[Element[i]]++] = i;
+  }
+
+  free(Element);
+  free(Count);
+}
+
+// Scatter Micro (1 if Micro is NULL) of the bucketed particles into Field, and
+// divide by the volume of the nodes
+
+void Compute_MesoGrid_Profile(gsl_matrix * Positions, gsl_vector * Micro, gsl_vector * z,
+                              struct MesoGrid * Grid, double * Field)
+{
+  memset(Field, 0, Grid->Size*sizeof(double));
+
+  // Element e writes in ElementSpan consecutive node layers (mod NNodes), so the
+  // elements e, e+ElementSpan, ... below NFull do not conflict, also across the
+  // periodic boundary. The elements left over when NNodes is not a multiple of
+  // ElementSpan form a last color, scattered serially
+  int NFull   = (NNodes/ElementSpan)*ElementSpan;
+  int NColors = ElementSpan + (NFull < NNodes);
+  for (int color=0;color<NColors;color++)
+  {
+    int Serial = (color == ElementSpan);
+    #pragma omp parallel for schedule(dynamic) if(!Serial)
+    for (int e=0;e<NNodes;e++)
+    {
+      int c = (e >= NFull) ? ElementSpan : e % ElementSpan;
+      if (c != color)
+        continue;
+
+      int    ix0[BasisChunk], ix1[BasisChunk], iy0[BasisChunk], iy1[BasisChunk];
+      double wx0[BasisChunk], wx1[BasisChunk], wy0[BasisChunk], wy1[BasisChunk];
+      double zi[BasisChunk], a[BasisChunk];
+      int    First[BasisChunk];
+      double Wz[BasisSupport*BasisChunk];
+
+      for (int first=Grid->ElementFirst[e];first<Grid->ElementFirst[e+1];first+=BasisChunk)
+      {
+        int n = min(BasisChunk, Grid->ElementFirst[e+1]-first);
+
+        // Weights of the chunk (vectorized)
+        #pragma omp simd
+        for (int k=0;k<n;k++)
+        {
+          int i = Grid->Particle[first+k];
+          double g, f;
+          g      = gsl_matrix_get(Positions,i,1)/Grid->dx;
+          f      = floor(g);
+          wx1[k] = g - f;
+          wx0[k] = 1.0 - wx1[k];
+          ix0[k] = (((int) f % Grid->Nx) + Grid->Nx) % Grid->Nx;
+          ix1[k] = (ix0[k] + 1) % Grid->Nx;
+          g      = gsl_matrix_get(Positions,i,2)/Grid->dy;
+          f      = floor(g);
+          wy1[k] = g - f;
+          wy0[k] = 1.0 - wy1[k];
+          iy0[k] = (((int) f % Grid->Ny) + Grid->Ny) % Grid->Ny;
+          iy1[k] = (iy0[k] + 1) % Grid->Ny;
+          zi[k]  = gsl_matrix_get(Positions,i,3);
+          a[k]   = (Micro == NULL) ? 1.0 : gsl_vector_get(Micro,i);
+        }
+        Basis_Weights_Block(z, n, zi, First, Wz);
+
+        // Scatter into the 4 x BasisSupport nodes of the particle
+        for (int k=0;k<n;k++)
+        {
+          for (int s=0;s<BasisSupport;s++)
+          {
+            int    mu = (First[k]+s) % NNodes;
+            double wz = a[k]*Wz[s*BasisChunk+k];
+            Field[GridNode(Grid,ix0[k],iy0[k],mu)] += wx0[k]*wy0[k]*wz;
+            Field[GridNode(Grid,ix1[k],iy0[k],mu)] += wx1[k]*wy0[k]*wz;
+            Field[GridNode(Grid,ix0[k],iy1[k],mu)] += wx0[k]*wy1[k]*wz;
+            Field[GridNode(Grid,ix1[k],iy1[k],mu)] += wx1[k]*wy1[k]*wz;
+          }
+        }
+      }
+    }
+  }
+
+  #if __MASS_MATRIX__
+    // The mass matrix is the tensor product of those of x, y and z (the latter
+    // over Lx Ly), so it is solved along each direction in turn
+    #pragma omp parallel for
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      for (int iy=0;iy<Grid->Ny;iy++)
+        Solve_MassMatrix(&Grid->MassX, Field + GridNode(Grid,0,iy,mu), 1);
+      for (int ix=0;ix<Grid->Nx;ix++)
+        Solve_MassMatrix(&Grid->MassY, Field + GridNode(Grid,ix,0,mu), Grid->Nx);
+    }
+    #pragma omp parallel for
+    for (long n=0;n<(long) Grid->Nx*Grid->Ny;n++)
+    {
+      Solve_MassMatrix(&NodeMass, Field + n, (size_t) Grid->Nx*Grid->Ny);
+      for (int mu=0;mu<NNodes;mu++)
+        Field[n + (long) mu*Grid->Nx*Grid->Ny] *= Lx*Ly;
+    }
+  #else
+    // Volume of a node: dx dy times the volume of the z node (over Lx Ly)
+    double Scale = Grid->dx*Grid->dy/(Lx*Ly);
+    #pragma omp parallel for
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      double iv = 1.0/(Scale*Lattice.Volume[mu]);
+      for (long n=GridNode(Grid,0,0,mu);n<GridNode(Grid,0,0,mu+1);n++)
+        Field[n] *= iv;
+    }
+  #endif
+}
+
+static long GridCell(struct MesoGrid * Grid, gsl_vector * z, double x, double y, double zz)
+{
+  int ix = (((int) floor(x/Grid->dx) % Grid->Nx) + Grid->Nx) % Grid->Nx;
+  int iy = (((int) floor(y/Grid->dy) % Grid->Ny) + Grid->Ny) % Grid->Ny;
+  zz    -= Lz*floor(zz/Lz);
+  return GridNode(Grid, ix, iy, Element_Of(z, zz));
+}
+
+static double CellVolume(struct MesoGrid * Grid, long cell)
+{
+  int mu = cell / ((long) Grid->Nx*Grid->Ny);
+  return Grid->dx*Grid->dy*Element_Volume(mu)/(Lx*Ly);
+}
+
+void Compute_MesoGrid_Sigma1(gsl_matrix * Positions, gsl_matrix * Velocities,
+                             struct MesoGrid * Grid)
+{
+  memset(Grid->Sigma1, 0, 9*Grid->Size*sizeof(double));
+
+  // The cells of an element are only written by its particles
+  #pragma omp parallel for schedule(dynamic)
+  for (int e=0;e<NNodes;e++)
+  {
+    for (int k=Grid->ElementFirst[e];k<Grid->ElementFirst[e+1];k++)
+    {
+      int    i    = Grid->Particle[k];
+      int    ix   = (((int) floor(gsl_matrix_get(Positions,i,1)/Grid->dx) % Grid->Nx) + Grid->Nx) % Grid->Nx;
+      int    iy   = (((int) floor(gsl_matrix_get(Positions,i,2)/Grid->dy) % Grid->Ny) + Grid->Ny) % Grid->Ny;
+      double m    = MassTable[(int) gsl_matrix_get(Positions,i,0)];
+      double * s  = Grid->Sigma1 + 9*GridNode(Grid,ix,iy,e);
+      for (int a=0;a<3;a++)
+        for (int b=0;b<3;b++)
+          s[3*a+b] += m*gsl_matrix_get(Velocities,i,a)*gsl_matrix_get(Velocities,i,b);
+    }
+  }
+
+  #pragma omp parallel for
+  for (long cell=0;cell<Grid->Size;cell++)
+  {
+    double iv = 1.0/CellVolume(Grid, cell);
+    for (int l=0;l<9;l++)
+      Grid->Sigma1[9*cell+l] *= iv;
+  }
+}
+
+static int CompareDoubles(const void * a, const void * b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+// Fractions of the bond from ri to ri + d (unwrapped) inside each cell.  The
+// bond is cut at the planes of the grid it crosses. Returns the number of pieces
+
+static void TooManyPieces(struct MesoGrid * Grid)
+{
+  PrintMsg("Error in the meso grid: a bond crosses too many cells. Exiting now...");
+  printf("\tMax. pieces of a bond: %d\n", Grid->MaxPieces);
+  exit(EXIT_FAILURE);
+}
+
+static int BondPieces(struct MesoGrid * Grid, gsl_vector * z, const double * ri, const double * d,
+                      double * Lambda, long * Cell)
+{
+  int MaxPieces = Grid->MaxPieces;
+  int n = 0;
+  Lambda[n++] = 0.0;
+
+  // Planes x = k dx and y = k dy
+  const double h[2] = {Grid->dx, Grid->dy};
+  const int    N[2] = {Grid->Nx, Grid->Ny};
+  for (int a=0;a<2;a++)
+  {
+    if ((N[a] == 1) || (d[a] == 0.0))
+      continue;
+    double lo = min(ri[a], ri[a]+d[a]);
+    double hi = max(ri[a], ri[a]+d[a]);
+    for (double p=ceil(lo/h[a])*h[a];p<hi;p+=h[a])
+    {
+      if (n == MaxPieces)
+        TooManyPieces(Grid);
+      if (p > lo)
+        Lambda[n++] = (p - ri[a])/d[a];
+    }
+  }
+
+  // Planes at the nodes in z (and their periodic images)
+  if (d[2] != 0.0)
+  {
+    double lo     = min(ri[2], ri[2]+d[2]);
+    double hi     = max(ri[2], ri[2]+d[2]);
+    double offset = Lz*floor(lo/Lz);
+    int    mu     = Node_Right(z, lo - offset);
+    while (1)
+    {
+      if (mu == NNodes)
+      {
+        mu      = 0;
+        offset += Lz;
+      }
+      double p = gsl_vector_get(z,mu) + offset;
+      if (p >= hi)
+        break;
+      if (n == MaxPieces)
+        TooManyPieces(Grid);
+      if (p > lo)
+        Lambda[n++] = (p - ri[2])/d[2];
+      mu++;
+    }
+  }
+
+  qsort(Lambda+1, n-1, sizeof(double), CompareDoubles);
+  Lambda[n] = 1.0;
+
+  // Cell of each piece, from its midpoint
+  for (int p=0;p<n;p++)
+  {
+    double l = 0.5*(Lambda[p]+Lambda[p+1]);
+    Cell[p]  = GridCell(Grid, z, ri[0]+l*d[0], ri[1]+l*d[1], ri[2]+l*d[2]);
+  }
+  return n;
+}
+
+void Compute_MesoGrid_Sigma2(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                             gsl_vector * List, gsl_vector * z, struct MesoGrid * Grid, int type)
+{
+  memset(Grid->Sigma2, 0, 9*Grid->Size*sizeof(double));
+
+  #pragma omp parallel
+  {
+    // Each thread accumulates in its own copy of the stress
+    double * Local  = calloc(9*Grid->Size, sizeof(double));
+    int    * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz));
+    double * Lambda = malloc((Grid->MaxPieces+1)*sizeof(double));
+    long   * Cell   = malloc(Grid->MaxPieces*sizeof(long));
+
+    #pragma omp for schedule(dynamic,16)
+    for (int k=Grid->ElementFirst[0];k<Grid->ElementFirst[NNodes];k++)
+    {
+      int i     = Grid->Particle[k];
+      int iCell = FindParticle(Positions,i);
+      gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
+      int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+
+      double ri[3] = {gsl_matrix_get(Positions,i,1), gsl_matrix_get(Positions,i,2),
+                      gsl_matrix_get(Positions,i,3)};
+
+      for (int jj=0;jj<NNeighbors;jj++)
+      {
+        // Each pair once (i < j), so the factor 1/2 is not needed
+        int j = Verlet[jj];
+        if ((j <= i) || !IsOfType((int) gsl_matrix_get(Positions,j,0), type))
+          continue;
+
+        double fij[3];
+        Compute_Force_ij(Positions, i, j, type, type, fij);
+
+        // rij = ri - rj (minimum image), and the bond goes from ri to ri - rij
+        double rij[3];
+        rij[0]  = ri[0] - gsl_matrix_get(Positions,j,1);
+        rij[0] -= Lx*round(rij[0]/Lx);
+        rij[1]  = ri[1] - gsl_matrix_get(Positions,j,2);
+        rij[1] -= Ly*round(rij[1]/Ly);
+        rij[2]  = ri[2] - gsl_matrix_get(Positions,j,3);
+        rij[2] -= Lz*round(rij[2]/Lz);
+        double d[3] = {-rij[0], -rij[1], -rij[2]};
+
+        // Pairs beyond Rcut have no force (and could cross more cells)
+        if (rij[0]*rij[0] + rij[1]*rij[1] + rij[2]*rij[2] > Rcut*Rcut)
+          continue;
+
+        int n = BondPieces(Grid, z, ri, d, Lambda, Cell);
+        for (int p=0;p<n;p++)
+        {
+          double   f = Lambda[p+1] - Lambda[p];
+          double * s = Local + 9*Cell[p];
+          for (int a=0;a<3;a++)
+            for (int b=0;b<3;b++)
+              s[3*a+b] += f*rij[a]*fij[b];
+        }
+      }
+    }
+
+    #pragma omp critical
+    {
+      for (long l=0;l<9*Grid->Size;l++)
+        Grid->Sigma2[l] += Local[l];
+    }
+
+    free(Local);
+    free(Verlet);
+    free(Lambda);
+    free(Cell);
+  }
+
+  #pragma omp parallel for
+  for (long cell=0;cell<Grid->Size;cell++)
+  {
+    double iv = 1.0/CellVolume(Grid, cell);
+    for (int l=0;l<9;l++)
+      Grid->Sigma2[9*cell+l] *= iv;
+  }
+}
+
+void Compute_MesoGrid(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Momentum,
+                      gsl_vector * Energy, gsl_vector * Kinetic, gsl_matrix * Neighbors,
+                      gsl_vector * ListHead, gsl_vector * List, struct TypeList * Types,
+                      gsl_vector * z, int type, struct MesoGrid * Grid)
+{
+  Compute_Element_Bins(Positions, Types, type, z, Grid->Particle, Grid->ElementFirst);
+
+  Compute_MesoGrid_Profile(Positions, NULL, z, Grid, Grid->Density);
+  for (int a=0;a<3;a++)
+  {
+    gsl_vector_view ga = gsl_matrix_column(Momentum,a);
+    Compute_MesoGrid_Profile(Positions, &ga.vector, z, Grid, Grid->Momentum + a*Grid->Size);
+  }
+  Compute_MesoGrid_Profile(Positions, Energy, z, Grid, Grid->Energy);
+  Compute_MesoGrid_Profile(Positions, Kinetic, z, Grid, Grid->Kinetic);
+
+  Compute_MesoGrid_Sigma1(Positions, Velocities, Grid);
+  Compute_MesoGrid_Sigma2(Positions, Neighbors, ListHead, List, z, Grid, type);
+
+  // Time averages
+  Grid->NSamples++;
+  #pragma omp parallel for
+  for (long n=0;n<Grid->Size;n++)
+  {
+    Grid->DensityAvg[n] += Grid->Density[n];
+    Grid->EnergyAvg[n]  += Grid->Energy[n];
+    Grid->KineticAvg[n] += Grid->Kinetic[n];
+    for (int a=0;a<3;a++)
+      Grid->MomentumAvg[a*Grid->Size+n] += Grid->Momentum[a*Grid->Size+n];
+    for (int l=0;l<9;l++)
+      Grid->SigmaAvg[9*n+l] += Grid->Sigma1[9*n+l] + Grid->Sigma2[9*n+l];
+  }
+}
+
+void SaveMesoGrid(char * basename, gsl_vector * z, struct MesoGrid * Grid)
+{
+  char   str[200];
+  double iN = (Grid->NSamples > 0) ? 1.0/Grid->NSamples : 0.0;
+
+  // Nodes: x y z density gx gy gz energy kinetic
+  sprintf(str, "./output/%s.MesoGrid.avg.dat", basename);
+  FILE * oFile = fopen(str, "w");
+  fprintf(oFile, "# x y z density momentum_x momentum_y momentum_z energy kinetic\n");
+  for (int mu=0;mu<NNodes;mu++)
+    for (int iy=0;iy<Grid->Ny;iy++)
+      for (int ix=0;ix<Grid->Nx;ix++)
+      {
+        long n = GridNode(Grid,ix,iy,mu);
+        fprintf(oFile, "%8.6e\t%8.6e\t%8.6e\t%8.6e\t%8.6e\t%8.6e\t%8.6e\t%8.6e\t%8.6e\n",
+                ix*Grid->dx, iy*Grid->dy, gsl_vector_get(z,mu), iN*Grid->DensityAvg[n],
+                iN*Grid->MomentumAvg[n], iN*Grid->MomentumAvg[Grid->Size+n],
+                iN*Grid->MomentumAvg[2*Grid->Size+n], iN*Grid->EnergyAvg[n], iN*Grid->KineticAvg[n]);
+      }
+  fclose(oFile);
+
+  // Cells: center of the cell and the nine components of the stress tensor
+  sprintf(str, "./output/%s.MesoGridSigma.avg.dat", basename);
+  oFile = fopen(str, "w");
+  fprintf(oFile, "# x y z xx xy xz yx yy yz zx zy zz\n");
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    double zc = (mu == NNodes-1) ? 0.5*gsl_vector_get(z,0)
+                                 : 0.5*(gsl_vector_get(z,mu)+gsl_vector_get(z,mu+1));
+    for (int iy=0;iy<Grid->Ny;iy++)
+      for (int ix=0;ix<Grid->Nx;ix++)
+      {
+        long n = GridNode(Grid,ix,iy,mu);
+        fprintf(oFile, "%8.6e\t%8.6e\t%8.6e", (ix+0.5)*Grid->dx, (iy+0.5)*Grid->dy, zc);
+        for (int l=0;l<9;l++)
+          fprintf(oFile, "\t%8.6e", iN*Grid->SigmaAvg[9*n+l]);
+        fprintf(oFile, "\n");
+      }
+  }
+  fclose(oFile);
+}
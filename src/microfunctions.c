@@ -12,8 +12,134 @@
  */
 #include "cg.h"
 
+void Compute_TypeList(gsl_matrix * Positions, struct TypeList * Types)
+{
+  int type;
+  int * Count = calloc(NTypes+1, sizeof(int));
+
+  // Count the number of particles of each type
+  for (int i=0;i<NParticles;i++)
+  {
+    type = (int) gsl_matrix_get(Positions,i,0);
+    if ((type < 1) || (type > NTypes))
+    {
+      PrintMsg("Error building type lists: atom type out of range. Exiting now...");
+      printf("\tParticle %d has type %d (NTypes = %d)\n", i, type, NTypes);
+      exit(EXIT_FAILURE);
+    }
+    Count[type]++;
+  }
+
+  // Type 0 refers to all the particles
+  Types->First[0] = 0;
+  Types->Last[0]  = NParticles;
+
+  // Ranges of each type inside Index (counting sort). The wall types go first,
+  // then the other types and the fluid types last
+  const int Class[3] = {WallType, -1, FluidType};
+  int offset = 0;
+  for (int c=0;c<3;c++)
+  {
+    int first = offset;
+    for (int t=1;t<=NTypes;t++)
+    {
+      if (TypeClass[t] != Class[c])
+        continue;
+      Types->First[t] = offset;
+      Types->Last[t]  = offset;
+      offset         += Count[t];
+    }
+    if (Class[c] > 0)
+    {
+      Types->First[Class[c]] = first;
+      Types->Last[Class[c]]  = offset;
+    }
+  }
+
+  // Fill the ranges keeping the original order inside each type
+  for (int i=0;i<NParticles;i++)
+  {
+    type = (int) gsl_matrix_get(Positions,i,0);
+    Types->Index[Types->Last[type]] = i;
+    Types->Last[type]++;
+  }
+
+  free(Count);
+}
+
+void Compute_Identity_Order(struct Ordering * Order)
+{
+  for (int i=0;i<NParticles;i++)
+  {
+    Order->Id[i]  = i;
+    Order->Row[i] = i;
+  }
+}
+
+// Spread the lower 10 bits of x so that there are two zeros between them
+
+static unsigned int SpreadBits(unsigned int x)
+{
+  x &= 0x000003ff;
+  x  = (x | (x << 16)) & 0xff0000ff;
+  x  = (x | (x <<  8)) & 0x0300f00f;
+  x  = (x | (x <<  4)) & 0x030c30c3;
+  x  = (x | (x <<  2)) & 0x09249249;
+  return x;
+}
+
+static int CompareKeys(const void * a, const void * b)
+{
+  const unsigned int * ka = a;
+  const unsigned int * kb = b;
+  if (ka[0] != kb[0])
+    return (ka[0] < kb[0]) ? -1 : 1;
+  return (ka[1] < kb[1]) ? -1 : (ka[1] > kb[1]);
+}
+
+void Compute_Spatial_Order(gsl_matrix * Positions, struct Ordering * Order)
+{
+  // Pairs (Morton key, row). The row breaks ties, so the order is reproducible
+  unsigned int * Keys = malloc(2 * NParticles * sizeof(unsigned int));
+
+  for (int i=0;i<NParticles;i++)
+  {
+    // Coordinates are quantized into 1024 slabs per direction
+    unsigned int ix = (unsigned int) (gsl_matrix_get(Positions,i,1) * 1024.0 / Lx);
+    unsigned int iy = (unsigned int) (gsl_matrix_get(Positions,i,2) * 1024.0 / Ly);
+    unsigned int iz = (unsigned int) (gsl_matrix_get(Positions,i,3) * 1024.0 / Lz);
+    Keys[2*i]   = SpreadBits(ix) | (SpreadBits(iy) << 1) | (SpreadBits(iz) << 2);
+    Keys[2*i+1] = i;
+  }
+
+  qsort(Keys, NParticles, 2 * sizeof(unsigned int), CompareKeys);
+
+  for (int i=0;i<NParticles;i++)
+  {
+    Order->Id[i]             = Keys[2*i+1];
+    Order->Row[Order->Id[i]] = i;
+  }
+
+  free(Keys);
+}
+
+void Apply_Order(struct Ordering * Order, gsl_matrix * Matrix)
+{
+  gsl_matrix * Copy = gsl_matrix_alloc(Matrix->size1, Matrix->size2);
+  gsl_matrix_memcpy(Copy, Matrix);
+
+  for (int i=0;i<NParticles;i++)
+  {
+    gsl_vector_view row = gsl_matrix_row(Copy, Order->Id[i]);
+    gsl_matrix_set_row(Matrix, i, &row.vector);
+  }
+
+  gsl_matrix_free(Copy);
+}
+
 void Compute_Forces(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Neighbors, 
-                    gsl_vector * ListHead, gsl_vector * List, int type1, int type2, 
+                    gsl_vector * ListHead, gsl_vector * List, struct TypeList * Types, 
+                    int type1, int type2, struct WallGrid * Grid, struct RDF * Rdf,
                     gsl_matrix * Forces, gsl_vector * Energy, gsl_vector * Kinetic )
 {
 
@@ -23,16 +149,27 @@ void Compute_Forces(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix
   gsl_vector_set_zero(Energy);
   gsl_vector_set_zero(Kinetic);
 
+  // Only type1 particles receive a force, so only they are visited (the walls
+  // are left to Compute_Walls)
+  const int * Visit  = Types->Index + Types->First[type1];
+  int         NVisit = Types->Last[type1] - Types->First[type1];
+
   // Begin of parallel region
   
+  // Several chunks per thread, otherwise dynamic behaves as static and the
+  // threads that get the dense walls finish last
   int omp_get_max_threads();
-  int chunks = NParticles / omp_get_max_threads();
+  int chunks = NVisit / (16*omp_get_max_threads());
+  if (chunks < 1) 
+    chunks = 1;
 
   #pragma omp parallel
   {
     #pragma omp for schedule (dynamic,chunks) 
-    for (int i=0;i<NParticles;i++)
+    for (int k=0;k<NVisit;k++)
     {
+      int i = Visit[k];
+
       gsl_vector_view vi = gsl_matrix_row(Velocities, i);
 
       double * fij = malloc(3*sizeof(double));
@@ -49,10 +186,36 @@ void Compute_Forces(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix
       // i interacts with all Verlet[j] particles (j = 0 .. NNeighbors-1)
       int * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz));
       int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+
+      // Pair histograms of the radial distribution functions (all the
+      // neighbors, also those replaced by the wall grid)
+      int ti       = (int) gsl_matrix_get(Positions,i,0);
+      if ((Rdf != NULL) && RDF_IsCenter(ti))
+      {
+        double * Hist = RDF_Center(Rdf, Positions, i);
+        for (int j=0;j<NNeighbors;j++)
+          RDF_Add(Rdf, Hist, Positions, i, Verlet[j]);
+      }
+      
+      // With a wall grid, the interaction of a type1 particle with the wall is
+      // interpolated and the wall neighbors are skipped below
+      int UseGrid  = (Grid != NULL);
+      if (UseGrid)
+      {
+        ei = InterpolateWallGrid(Grid, ti, gsl_matrix_get(Positions,i,1), gsl_matrix_get(Positions,i,2),
+                                 gsl_matrix_get(Positions,i,3), fij);
+        Forces->data[i*Forces->tda + 0] += fij[0];
+        Forces->data[i*Forces->tda + 1] += fij[1];
+        Forces->data[i*Forces->tda + 2] += fij[2];
+        Energy->data[i*Energy->stride]  += ei;
+      }
       
       // Loop over all the j-neighbors of i-particle
       for (int j=0;j<NNeighbors;j++)
       {
+        int tj = (int) gsl_matrix_get(Positions,Verlet[j],0);
+        if (UseGrid && IsOfType(tj, type2))
+          continue;
         ei = Compute_Force_ij(Positions, i, Verlet[j], type1, type2, fij);
         Forces->data[i*Forces->tda + 0] += fij[0];
         Forces->data[i*Forces->tda + 1] += fij[1];
@@ -66,77 +229,85 @@ void Compute_Forces(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix
   // End of parallel region
 }
 
-void GetLJParams(double type1, double type2, double * lj)
+void Compute_Walls(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Neighbors,
+                   gsl_vector * ListHead, gsl_vector * List, struct TypeList * Types,
+                   int type1, gsl_matrix * Cross, gsl_vector * Energy, gsl_vector * Kinetic)
 {
-  if (type1 == type2)
+  if (Cross != NULL)
+    gsl_matrix_set_zero(Cross);
+
+  #pragma omp parallel
   {
-    if (type1 == 1.0) 
-    {
-      lj[0] = e1;
-      lj[1] = s1;
-      lj[2] = ecut1;
-    }
-    else
+    int  * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz));
+    double fij[3];
+
+    // Only the particles that are not of type1 (the ranges of the other types)
+    #pragma omp for schedule(dynamic,64)
+    for (int k=0;k<NParticles;k++)
     {
-      lj[0] = e2;
-      lj[1] = s2;
-      lj[2] = ecut2;
+      if ((k >= Types->First[type1]) && (k < Types->Last[type1]))
+        continue;
+      int i = Types->Index[k];
+
+      gsl_vector_view vi = gsl_matrix_row(Velocities, i);
+      gsl_vector_set(Kinetic,i,KineticEnergy(&vi.vector, (int) gsl_matrix_get(Positions,i,0)));
+
+      int iCell = FindParticle(Positions,i);
+      gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
+      int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+
+      double ei = 0.0;
+      for (int j=0;j<NNeighbors;j++)
+      {
+        int Fluid = IsOfType((int) gsl_matrix_get(Positions,Verlet[j],0), type1);
+
+        // The wall-wall pairs only add to the energy
+        #if !__COMPUTE_MACRO_ENERGY__
+          if (!Fluid)
+            continue;
+        #endif
+        double eij = Compute_Force_ij(Positions, i, Verlet[j], 0, 0, fij);
+        ei += eij;
+        if (Fluid && (Cross != NULL))
+        {
+          Cross->data[i*Cross->tda + 0] += fij[0];
+          Cross->data[i*Cross->tda + 1] += fij[1];
+          Cross->data[i*Cross->tda + 2] += fij[2];
+          Cross->data[i*Cross->tda + 3] += eij;
+        }
+      }
+      Energy->data[i*Energy->stride] = ei;
     }
-  } 
-  else
-  {
-      lj[0] = e12;
-      lj[1] = s12;
-      lj[2] = ecut12;
+
+    free(Verlet);
   }
 }
 
+void GetLJParams(double type1, double type2, double * lj)
+{
+  const struct PairParameters * pair = PairTable + (int) type1*(NTypes+1) + (int) type2;
+  lj[0] = pair->epsilon;
+  lj[1] = sqrt(pair->sigma2);
+  lj[2] = pair->ecut;
+}
+
 double GetLJepsilon(int type1, int type2)
 {
-  double epsilon;
-  if (type1 == type2)
-  {
-    if (type1 == 1.0) 
-    {
-      epsilon = e1;
-    }
-    else
-    {
-      epsilon = e2;
-    }
-  } 
-  else
-  {
-    epsilon = e12;
-  }
-  return epsilon;
+  return PairTable[type1*(NTypes+1)+type2].epsilon;
 }
 
 double GetLJsigma(int type1, int type2)
 {
-  double sigma;
-  if (type1 == type2)
-  {
-    if (type1 == 1.0) 
-    {
-      sigma   = s1;
-    }
-    else
-    {
-      sigma = s2;
-    }
-  } 
-  else
-  {
-    sigma = s12;
-  }
-  return sigma;
+  return sqrt(PairTable[type1*(NTypes+1)+type2].sigma2);
 }
 
 double Compute_Force_ij (gsl_matrix * Positions, int i, int j, int type1, int type2, double * fij)
 {
-   double r2i, r6i, ff;
+   double ff;
    double eij = 0.0;
+
+   int    ti      = (int) Positions->data[i*Positions->tda];
+   int    tj      = (int) Positions->data[j*Positions->tda];
    
    double deltax  = Positions->data[i*Positions->tda + 1] - Positions->data[j*Positions->tda + 1];
           deltax -= Lx*round(deltax/Lx);
@@ -147,34 +318,22 @@ double Compute_Force_ij (gsl_matrix * Positions, int i, int j, int type1, int ty
 
    double r2      = deltax*deltax + deltay*deltay + deltaz*deltaz;
 
-   // Obtain LJ parameters
-   double * lj = malloc(3*sizeof(float));
-   GetLJParams(gsl_matrix_get(Positions,i,0), gsl_matrix_get(Positions,j,0), lj);
-   double epsilon = lj[0];
-   double sigma   = lj[1];
-   double ecut    = lj[2];
-   free (lj);
-
-   // Compute the force
-   r2i      = sigma*sigma/r2;
-   r6i      = pow(r2i,3);
-   ff       = 48.0*epsilon*r2i*r6i*(r6i-0.5);
-
-   fij[0] = 0.0;
-   fij[1] = 0.0;
-   fij[2] = 0.0;
-
-   if (((type1 == 0)&&(type2 == 0)) || ((((int) gsl_matrix_get(Positions,i,0)) == type1)&&(((int) gsl_matrix_get(Positions,j,0) == type2))))
-   {
-     fij[0] = ff*deltax;  
-     fij[1] = ff*deltay;  
-     fij[2] = ff*deltaz;  
-   }
-
-   // Compute the potential energy
-   // In lammps, pair_modify shift yes implies the existence of an ecut
-   // eij = 4.0*epsilon*r6i*(r6i-1.0);
-   eij = 4.0*epsilon*r6i*(r6i-1.0)-ecut;
+   // Obtain the parameters of the pair
+   const struct PairParameters * pair = PairTable + ti*(NTypes+1) + tj;
+
+   // 1.0 if the pair is within its own cut-off, 0.0 otherwise
+   double inside  = (r2 <= pair->rcut2);
+
+   // 1.0 if the force acts on this pair (see cg.h), 0.0 otherwise
+   double filter  = (((type1 == 0)&&(type2 == 0)) || (IsOfType(ti, type1)&&IsOfType(tj, type2)));
+
+   // Compute the potential energy and the force (divided by r)
+   eij      = inside*Eval_Pair(pair, r2, &ff);
+   ff      *= inside;
+
+   fij[0] = filter*ff*deltax;  
+   fij[1] = filter*ff*deltay;  
+   fij[2] = filter*ff*deltaz;  
 
    return eij;
 }
@@ -183,16 +342,7 @@ double KineticEnergy (gsl_vector * v, int type)
 {
   double K = pow(gsl_vector_get(v,0),2) + pow(gsl_vector_get(v,1),2) + pow(gsl_vector_get(v,2),2);
   
-  switch (type)
-  {
-    case 1:
-      K *= 0.5 * m1;
-      break;
-    case 2:
-      K *= 0.5 * m2;
-      break;
-  }
-  return K;
+  return 0.5 * MassTable[type] * K;
 }
 
 void Compute_Velocity_Module (gsl_matrix * Velocities, gsl_vector * Vmod)
@@ -262,14 +412,7 @@ void Compute_Momentum(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matri
   for (int i=0;i<NParticles;i++)
   {
     gsl_vector_view gi = gsl_matrix_row(Momentum,i);
-    if ((int) gsl_matrix_get(Positions,i,0) == 1 )
-    {
-      gsl_vector_scale(&gi.vector,m1);
-    }
-    else
-    {
-      gsl_vector_scale(&gi.vector,m2);
-    }
+    gsl_vector_scale(&gi.vector,MassTable[(int) gsl_matrix_get(Positions,i,0)]);
   }
 }
 
@@ -0,0 +1,142 @@
+/*
+ * Filename   : mop.c
+ *
+ * Created    : 20.10.2026
+ *
+ * Modified   : mar 20 oct 2026 12:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Method of planes: pressure tensor P_az (a = x, y, z) at the
+ *              node planes
+ *
+ */
+
+#include "cg.h"
+
+// The configurational part is the force that the fluid below each plane exerts
+// on the fluid above it (per unit area):  every pair i-j whose bond crosses the
+// plane adds sign(zi - zj) fij / (Lx Ly). The pairs are the same as in
+// Compute_Meso_Sigma2,  so MesoMOP2 can be cross-checked with the zx, zy and zz
+// components of MesoSigma2 (e.g. their averages over a region of constant P_zz).
+//
+// The kinetic part is the momentum carried across the planes between two
+// consecutive snapshots, m v_a sign(dz) / (Lx Ly SnapshotDt),  with v the mean
+// velocity of both snapshots.  Particles that cross a plane and come back
+// between the snapshots are missed, so SnapshotDt must be short.
+
+void Compute_Meso_MOP(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                      gsl_vector * List, struct TypeList * Types, gsl_vector * z,
+                      gsl_matrix * MesoMOP2)
+{
+  gsl_matrix_set_zero(MesoMOP2);
+
+  #pragma omp parallel
+  {
+    double * Local  = calloc(3*NNodes, sizeof(double));
+    int    * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz));
+    int    * Node   = malloc(NNodes*sizeof(int));
+
+    #pragma omp for schedule(dynamic,16)
+    for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+    {
+      int    i     = Types->Index[k];
+      double zi    = gsl_matrix_get(Positions,i,3);
+      int    iCell = FindParticle(Positions,i);
+      gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
+      int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+
+      for (int jj=0;jj<NNeighbors;jj++)
+      {
+        int j = Verlet[jj];
+        if ((j <= i) || !IsOfType((int) gsl_matrix_get(Positions,j,0), FluidType))
+          continue;
+
+        double rz  = zi - gsl_matrix_get(Positions,j,3);
+               rz -= Lz*round(rz/Lz);
+
+        // Bond from zi to zi - rz (nearest image of j)
+        int NPlanes = Bond_Planes(z, zi, -rz, Node);
+        if (NPlanes == 0)
+          continue;
+
+        double fij[3];
+        Compute_Force_ij(Positions, i, j, FluidType, FluidType, fij);
+        double s = (rz > 0.0) ? 1.0 : -1.0;
+        for (int p=0;p<NPlanes;p++)
+          for (int a=0;a<3;a++)
+            Local[3*Node[p]+a] += s*fij[a];
+      }
+    }
+
+    #pragma omp critical
+    for (int l=0;l<3*NNodes;l++)
+      MesoMOP2->data[(l/3)*MesoMOP2->tda + l%3] += Local[l];
+
+    free(Local);
+    free(Verlet);
+    free(Node);
+  }
+
+  gsl_matrix_scale(MesoMOP2, 1.0/(Lx*Ly));
+}
+
+void Compute_Meso_MOP_Kinetic(gsl_matrix * Positions, gsl_matrix * Velocities, struct TypeList * Types,
+                              struct Ordering * Order, gsl_vector * z, gsl_matrix * Previous,
+                              int Step, gsl_matrix * MesoMOP1)
+{
+  gsl_matrix_set_zero(MesoMOP1);
+
+  // Crossings between the previous snapshot and this one. Previous is indexed
+  // by the row of each particle in the input files (z vx vy vz)
+  if (Step > 0)
+  {
+    #pragma omp parallel
+    {
+      double * Local = calloc(3*NNodes, sizeof(double));
+      int    * Node  = malloc(NNodes*sizeof(int));
+
+      #pragma omp for schedule(static)
+      for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+      {
+        int    i   = Types->Index[k];
+        int    id  = Order->Id[i];
+        double z0  = gsl_matrix_get(Previous,id,0);
+        double dz  = gsl_matrix_get(Positions,i,3) - z0;
+               dz -= Lz*round(dz/Lz);
+
+        int NPlanes = Bond_Planes(z, z0, dz, Node);
+        if (NPlanes == 0)
+          continue;
+
+        double m = MassTable[(int) gsl_matrix_get(Positions,i,0)];
+        double s = (dz > 0.0) ? 1.0 : -1.0;
+        for (int a=0;a<3;a++)
+        {
+          double v = 0.5*(gsl_matrix_get(Velocities,i,a) + gsl_matrix_get(Previous,id,a+1));
+          for (int p=0;p<NPlanes;p++)
+            Local[3*Node[p]+a] += s*m*v;
+        }
+      }
+
+      #pragma omp critical
+      for (int l=0;l<3*NNodes;l++)
+        MesoMOP1->data[(l/3)*MesoMOP1->tda + l%3] += Local[l];
+
+      free(Local);
+      free(Node);
+    }
+    gsl_matrix_scale(MesoMOP1, 1.0/(Lx*Ly*SnapshotDt));
+  }
+
+  // Keep this snapshot for the next one
+  #pragma omp parallel for schedule(static)
+  for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+  {
+    int i  = Types->Index[k];
+    int id = Order->Id[i];
+    gsl_matrix_set(Previous,id,0,gsl_matrix_get(Positions,i,3));
+    for (int a=0;a<3;a++)
+      gsl_matrix_set(Previous,id,a+1,gsl_matrix_get(Velocities,i,a));
+  }
+}
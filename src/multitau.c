@@ -0,0 +1,241 @@
+/*
+ * Filename   : multitau.c
+ *
+ * Created    : 20.10.2026
+ *
+ * Modified   : mar 20 oct 2026 18:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Multiple tau correlator for the mean squared displacement and
+ *              the velocity autocorrelation of the fluid, resolved by element
+ *
+ */
+
+#include "cg.h"
+
+// Level k keeps the last MultipleTauP values of each atom, every value being
+// the average of MultipleTauM values of level k-1 (a block of MultipleTauM^k
+// snapshots at level k).  The newest value of a level is correlated with the
+// older ones,  lag j MultipleTauM^k (j >= MultipleTauP/MultipleTauM for k > 0,
+// the shorter lags are in the level below). The memory per atom grows as
+// log(NSteps).  The contribution of a pair of values goes to the element of the
+// atom at the older one (the time origin).
+//
+// The values are x y z (unwrapped) and vx vy vz.  All the atoms receive their
+// values at the same snapshots,  so the bookkeeping of the levels (Head,
+// NValues and MCount) is shared.
+
+#define MTValues 6
+
+void AllocMultipleTau(struct MultipleTau * MT)
+{
+  if (MultipleTauP % MultipleTauM != 0)
+  {
+    PrintMsg("Error in the multiple tau correlator: MultipleTauP is not a multiple of MultipleTauM. Exiting now...");
+    printf("\tMultipleTauP = %d, MultipleTauM = %d\n", MultipleTauP, MultipleTauM);
+    exit(EXIT_FAILURE);
+  }
+
+  // Enough levels for lags up to NSteps-1
+  MT->NLevels = 1;
+  for (long Lag=MultipleTauP-1;Lag<NSteps-1;Lag*=MultipleTauM)
+    MT->NLevels++;
+
+  int n = MT->NLevels*MultipleTauP*NNodes;
+
+  MT->NAtoms  = 0;
+  MT->NFrames = 0;
+  MT->Slot    = AllocArray(NParticles, sizeof(int));
+  MT->Head    = calloc(MT->NLevels, sizeof(int));
+  MT->NValues = calloc(MT->NLevels, sizeof(int));
+  MT->MCount  = calloc(MT->NLevels, sizeof(int));
+  MT->Sum     = calloc(MTQuantities*n, sizeof(double));
+  MT->Count   = calloc(n, sizeof(double));
+  MT->D       = NULL;
+  MT->A       = NULL;
+  MT->Image   = NULL;
+}
+
+void FreeMultipleTau(struct MultipleTau * MT)
+{
+  free(MT->Slot);
+  free(MT->Head);
+  free(MT->NValues);
+  free(MT->MCount);
+  free(MT->Sum);
+  free(MT->Count);
+  free(MT->D);
+  free(MT->A);
+  free(MT->Image);
+}
+
+void Compute_MultipleTau(struct MultipleTau * MT, gsl_matrix * Positions, gsl_matrix * Velocities,
+                         struct TypeList * Types, struct Ordering * Order, gsl_vector * z)
+{
+  int    NLevels = MT->NLevels;
+  double L[3]    = {Lx, Ly, Lz};
+
+  // The atoms of the fluid get a slot (by row in the input files) in the first
+  // snapshot. Image keeps the unwrapped and the last wrapped positions
+  if (MT->NFrames == 0)
+  {
+    for (int i=0;i<NParticles;i++)
+      MT->Slot[i] = -1;
+    for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+      MT->Slot[Order->Id[Types->Index[k]]] = MT->NAtoms++;
+
+    MT->D     = calloc((size_t) MT->NAtoms*NLevels*MultipleTauP*MTValues, sizeof(double));
+    MT->A     = calloc((size_t) MT->NAtoms*NLevels*MTValues, sizeof(double));
+    MT->Image = calloc((size_t) MT->NAtoms*6, sizeof(double));
+  }
+
+  // Levels that receive a value in this snapshot (0 ... K), and whether the
+  // accumulator of each one is passed to the next level
+  int K = 0;
+  int Pass[NLevels];
+  for (int k=0;k<NLevels;k++)
+  {
+    Pass[k] = 0;
+    if (k > K)
+      continue;
+    MT->Head[k]    = (MT->Head[k] + MultipleTauP - 1) % MultipleTauP;
+    MT->NValues[k] = min(MT->NValues[k] + 1, MultipleTauP);
+    if (++MT->MCount[k] == MultipleTauM)
+    {
+      MT->MCount[k] = 0;
+      Pass[k]       = 1;
+      if (k+1 < NLevels)
+        K = k+1;
+    }
+  }
+
+  #pragma omp parallel
+  {
+    int      n     = NLevels*MultipleTauP*NNodes;
+    double * Sum   = calloc(MTQuantities*n, sizeof(double));
+    double * Count = calloc(n, sizeof(double));
+
+    #pragma omp for schedule(static)
+    for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+    {
+      int      i     = Types->Index[k];
+      int      a     = MT->Slot[Order->Id[i]];
+      double * Image = MT->Image + 6*a;
+      double   v[MTValues];
+
+      // Unwrap the positions (the displacement between two snapshots is less
+      // than half the box)
+      for (int c=0;c<3;c++)
+      {
+        double r = gsl_matrix_get(Positions,i,c+1);
+        if (MT->NFrames == 0)
+        {
+          Image[c] = r;
+        }
+        else
+        {
+          double dr  = r - Image[3+c];
+                 dr -= L[c]*round(dr/L[c]);
+          Image[c]  += dr;
+        }
+        Image[3+c] = r;
+        v[c]       = Image[c];
+        v[3+c]     = gsl_matrix_get(Velocities,i,c);
+      }
+
+      for (int l=0;l<=K;l++)
+      {
+        double * D   = MT->D + ((size_t) a*NLevels + l)*MultipleTauP*MTValues;
+        double * Acc = MT->A + ((size_t) a*NLevels + l)*MTValues;
+        double * New = D + MT->Head[l]*MTValues;
+
+        for (int c=0;c<MTValues;c++)
+        {
+          New[c]  = v[c];
+          Acc[c] += v[c];
+        }
+
+        int j0 = (l == 0) ? 0 : MultipleTauP/MultipleTauM;
+        for (int j=j0;j<MT->NValues[l];j++)
+        {
+          double * Old = D + ((MT->Head[l] + j) % MultipleTauP)*MTValues;
+          double   zo  = Old[2] - Lz*floor(Old[2]/Lz);
+          int      b   = (l*MultipleTauP + j)*NNodes + Element_Of(z, zo);
+
+          double dx = New[0] - Old[0];
+          double dy = New[1] - Old[1];
+          double dz = New[2] - Old[2];
+          Sum[0*n+b] += dx*dx + dy*dy;
+          Sum[1*n+b] += dz*dz;
+          Sum[2*n+b] += New[3]*Old[3] + New[4]*Old[4];
+          Sum[3*n+b] += New[5]*Old[5];
+          Count[b]   += 1.0;
+        }
+
+        // Block average for the next level
+        if (Pass[l])
+        {
+          for (int c=0;c<MTValues;c++)
+          {
+            v[c]   = Acc[c]/MultipleTauM;
+            Acc[c] = 0.0;
+          }
+        }
+      }
+    }
+
+    #pragma omp critical
+    {
+      for (int b=0;b<MTQuantities*n;b++)
+        MT->Sum[b] += Sum[b];
+      for (int b=0;b<n;b++)
+        MT->Count[b] += Count[b];
+    }
+
+    free(Sum);
+    free(Count);
+  }
+
+  MT->NFrames++;
+}
+
+void SaveMultipleTau(char * basename, struct MultipleTau * MT)
+{
+  char * Name[MTQuantities] = {"MSD_xy", "MSD_z", "VACF_xy", "VACF_z"};
+  char   str[100];
+  int    n = MT->NLevels*MultipleTauP*NNodes;
+
+  gsl_vector * Meso = gsl_vector_calloc(NNodes);
+
+  for (int q=0;q<MTQuantities;q++)
+  {
+    sprintf(str, "./output/%s.Meso%s.dat", basename, Name[q]);
+    FILE * oFile = fopen(str, "w");
+
+    long Scale = 1;
+    for (int l=0;l<MT->NLevels;l++)
+    {
+      int j0 = (l == 0) ? 0 : MultipleTauP/MultipleTauM;
+      for (int j=j0;j<MultipleTauP;j++)
+      {
+        // Lags longer than the trajectory have no samples
+        double Samples = 0.0;
+        for (int mu=0;mu<NNodes;mu++)
+        {
+          int    b = (l*MultipleTauP + j)*NNodes + mu;
+          double c = MT->Count[b];
+          Samples += c;
+          gsl_vector_set(Meso, mu, (c > 0.0) ? MT->Sum[q*n+b]/c : 0.0);
+        }
+        if (Samples > 0.0)
+          PrintInfo(j*Scale, Meso, oFile);
+      }
+      Scale *= MultipleTauM;
+    }
+
+    fclose(oFile);
+  }
+
+  gsl_vector_free(Meso);
+}
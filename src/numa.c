@@ -0,0 +1,218 @@
+/*
+ * Filename   : numa.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 18:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : NUMA aware allocation (first touch) and thread placement
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include "cg.h"
+
+// Linux places a page in the NUMA node of the thread that first writes it. The
+// per-atom arrays are allocated without touching them and zeroed in parallel,
+// one block of rows per thread, so each block lives in the node of its thread
+// instead of all of them in the node of the master thread. That spreads the
+// memory traffic over all the nodes. Only loops with a static schedule over
+// the rows (and arrays with one block per thread, such as the histograms of
+// the RDF) read local memory. The force, stress and method of planes loops
+// keep their dynamic schedules, which balance the dense walls, and read from
+// every node.
+
+static void FirstTouch(void * Data, size_t Size)
+{
+  #if __NUMA_AWARE__
+    #pragma omp parallel
+    {
+      int    t     = omp_get_thread_num();
+      int    n     = omp_get_num_threads();
+      size_t first = Size*t/n;
+      size_t last  = Size*(t+1)/n;
+      memset((char *) Data + first, 0, last-first);
+    }
+  #else
+    memset(Data, 0, Size);
+  #endif
+}
+
+void * AllocArray(size_t n, size_t size)
+{
+  void * Data = malloc(n*size);
+  FirstTouch(Data, n*size);
+  return Data;
+}
+
+gsl_matrix * AllocMatrix(size_t n1, size_t n2)
+{
+  gsl_matrix * m = gsl_matrix_alloc(n1, n2);
+  FirstTouch(m->data, n1*m->tda*sizeof(double));
+  return m;
+}
+
+gsl_vector * AllocVector(size_t n)
+{
+  gsl_vector * v = gsl_vector_alloc(n);
+  FirstTouch(v->data, n*v->stride*sizeof(double));
+  return v;
+}
+
+// Parse a cpulist of /sys (e.g. "0-3,8-11"). Returns the number of cpus
+
+static int ReadCpuList(const char * File, int * Cpus, int MaxCpus)
+{
+  FILE * iFile = fopen(File, "r");
+  if (!iFile)
+    return 0;
+
+  char line[4096];
+  int  n = 0;
+  if (fgets(line, sizeof(line), iFile) != NULL)
+  {
+    char * token = strtok(line, ",\n");
+    while (token != NULL)
+    {
+      int lo, hi;
+      int k = sscanf(token, "%d-%d", &lo, &hi);
+      if (k == 1)
+        hi = lo;
+      for (int c=lo;(k >= 1)&&(c<=hi)&&(n<MaxCpus);c++)
+        Cpus[n++] = c;
+      token = strtok(NULL, ",\n");
+    }
+  }
+  fclose(iFile);
+  return n;
+}
+
+// Keep the cpus of the list that are in the mask. Returns how many are left
+
+static int KeepAllowed(int * Cpus, int n, cpu_set_t * Allowed)
+{
+  int k = 0;
+  for (int c=0;c<n;c++)
+    if ((Cpus[c] < CPU_SETSIZE) && CPU_ISSET(Cpus[c], Allowed))
+      Cpus[k++] = Cpus[c];
+  return k;
+}
+
+void Setup_Threads(void)
+{
+  int NThreads = omp_get_max_threads();
+  int MaxCpus  = CPU_SETSIZE;
+
+  // Cpus this process may run on (cgroup cpuset, or the mask of the batch
+  // scheduler or taskset)
+  cpu_set_t Allowed;
+  if (sched_getaffinity(0, sizeof(Allowed), &Allowed) != 0)
+  {
+    CPU_ZERO(&Allowed);
+    for (int c=0;c<MaxCpus;c++)
+      CPU_SET(c, &Allowed);
+  }
+
+  // NUMA nodes and their allowed cpus. Without /sys information, a single node
+  // with all the online cpus is assumed
+  int   NNuma     = 0;
+  int * NodeCpus  = malloc(MaxCpus*sizeof(int));
+  int * NodeFirst = malloc((MaxCpus+1)*sizeof(int));
+  NodeFirst[0] = 0;
+  for (int node=0;node<MaxCpus;node++)
+  {
+    char File[128];
+    sprintf(File, "/sys/devices/system/node/node%d/cpulist", node);
+    if (access(File, R_OK) != 0)
+      break;
+    int n = ReadCpuList(File, NodeCpus + NodeFirst[NNuma], MaxCpus - NodeFirst[NNuma]);
+    NodeFirst[NNuma+1] = NodeFirst[NNuma] + KeepAllowed(NodeCpus + NodeFirst[NNuma], n, &Allowed);
+    NNuma++;
+  }
+  if (NNuma == 0)
+  {
+    int n = ReadCpuList("/sys/devices/system/cpu/online", NodeCpus, MaxCpus);
+    if (n == 0)
+    {
+      n = min(sysconf(_SC_NPROCESSORS_ONLN), MaxCpus);
+      for (int c=0;c<n;c++)
+        NodeCpus[c] = c;
+    }
+    NNuma        = 1;
+    NodeFirst[1] = KeepAllowed(NodeCpus, n, &Allowed);
+  }
+  int NCpus = NodeFirst[NNuma];
+
+  PrintMsg("Thread placement:");
+  printf("\tNUMA nodes: %d\n", NNuma);
+  for (int node=0;node<NNuma;node++)
+    printf("\t  node %d: %d cpus\n", node, NodeFirst[node+1]-NodeFirst[node]);
+  printf("\tAllowed cpus: %d\n", NCpus);
+  printf("\tThreads: %d\n", NThreads);
+
+  // An explicit OpenMP binding has priority over ThreadPlacement
+  if ((getenv("OMP_PROC_BIND") != NULL) || (getenv("OMP_PLACES") != NULL))
+  {
+    printf("\tPlacement: given by OMP_PROC_BIND/OMP_PLACES\n");
+  }
+  else if (ThreadPlacement == PlacementNone)
+  {
+    printf("\tPlacement: none (threads are not pinned)\n");
+  }
+  else if (NCpus < NThreads)
+  {
+    // Pinning would stack threads on the same cpus
+    printf("\tPlacement: none (less allowed cpus than threads)\n");
+  }
+  else
+  {
+    // Cpu of each thread. Compact fills one node before the next one, Spread
+    // deals the threads round robin over the nodes with free cpus left. Each
+    // thread gets its own cpu
+    int * Cpu  = malloc(NThreads*sizeof(int));
+    int * Used = calloc(NNuma, sizeof(int));
+    int   node = NNuma-1;
+    for (int t=0;t<NThreads;t++)
+    {
+      if (ThreadPlacement == PlacementCompact)
+      {
+        Cpu[t] = NodeCpus[t];
+      }
+      else
+      {
+        do
+          node = (node+1) % NNuma;
+        while (Used[node] == NodeFirst[node+1] - NodeFirst[node]);
+        Cpu[t] = NodeCpus[NodeFirst[node] + Used[node]++];
+      }
+    }
+
+    int Failed = 0;
+    #pragma omp parallel reduction(+:Failed)
+    {
+      cpu_set_t Set;
+      CPU_ZERO(&Set);
+      CPU_SET(Cpu[omp_get_thread_num()], &Set);
+      Failed += (sched_setaffinity(0, sizeof(Set), &Set) != 0);
+    }
+
+    printf("\tPlacement: %s\n", (ThreadPlacement == PlacementCompact) ? "compact" : "spread");
+    printf("\tThread -> cpu:");
+    for (int t=0;t<NThreads;t++)
+      printf(" %d->%d", t, Cpu[t]);
+    printf("\n");
+    if (Failed)
+      printf("\tWarning: %d threads could not be pinned\n", Failed);
+
+    free(Cpu);
+    free(Used);
+  }
+
+  printf("\tFirst touch allocation of per-atom arrays: %s\n", __NUMA_AWARE__ ? "true" : "false");
+
+  free(NodeCpus);
+  free(NodeFirst);
+}
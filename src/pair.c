@@ -0,0 +1,357 @@
+/*
+ * Filename   : pair.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 12:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Pair styles (LJ and tabulated potentials) and the table of
+ *              pair parameters
+ *
+ */
+
+#include "cg.h"
+
+struct PairParameters PairTable[(NTypes+1)*(NTypes+1)];
+
+double MassTable[NTypes+1];
+
+int TypeClass[NTypes+1];
+
+int AllPairsLJ;
+
+double Pair_LJ(const struct PairParameters * pair, double r2, double * ff)
+{
+  return LJ_Pair(pair, r2, ff);
+}
+
+double Pair_Table(const struct PairParameters * pair, double r2, double * ff)
+{
+  // Position inside the table, in units of the width of the intervals
+  double u = (r2 - pair->s0)*pair->ids;
+  int    k = (int) u;
+
+  // Distances below the inner cut-off of the table use its first point
+  if (u < 0.0)
+  {
+    k = 0;
+    u = 0.0;
+  }
+  else if (k >= pair->n)
+  {
+    k = pair->n-1;
+  }
+  u -= k;
+
+  const double * c = pair->Spline + 8*k;
+
+  *ff = c[4] + u*(c[5] + u*(c[6] + u*c[7]));
+
+  return c[0] + u*(c[1] + u*(c[2] + u*c[3]));
+}
+
+static void PairTableError(char * Msg, char * File, char * Keyword)
+{
+  PrintMsg(Msg);
+  printf("\tThe table file was: %s (keyword %s)\n", File, Keyword);
+  exit(EXIT_FAILURE);
+}
+
+// Next token of the parameter line, which must be a number
+
+static double PairTableValue(char * File, char * Keyword)
+{
+  char * token = strtok(NULL, " \t\n");
+  char * end;
+  double value = (token != NULL) ? strtod(token, &end) : 0.0;
+  if ((token == NULL) || (end == token) || (*end != '\0'))
+    PairTableError("Error reading pair table: bad parameter line. Exiting now...", File, Keyword);
+  return value;
+}
+
+double Read_PairTable(char * File, char * Keyword, struct PairParameters * pair)
+{
+  FILE * iFile = fopen(File, "r");
+  if (!iFile)
+  {
+    PrintMsg("Error reading pair table. Exiting now...");
+    printf("\tThe table file was: %s\n", File);
+    exit(EXIT_FAILURE);
+  }
+
+  // Look for the section Keyword
+  char line[256];
+  char word[256];
+  int  found = 0;
+  while (fgets(line, sizeof(line), iFile) != NULL)
+  {
+    if ((sscanf(line, "%255s", word) == 1) && (strcmp(word, Keyword) == 0))
+    {
+      found = 1;
+      break;
+    }
+  }
+  if (!found)
+  {
+    PrintMsg("Error reading pair table: keyword not found. Exiting now...");
+    printf("\tThe table file was: %s (keyword %s)\n", File, Keyword);
+    exit(EXIT_FAILURE);
+  }
+
+  // Parameter line: N n [R rlo rhi | RSQ rlo rhi] [FP fplo fphi]
+  int    N      = 0;
+  int    spacing = 0;  // 0: r is read from the file, 1: R, 2: RSQ
+  double rlo = 0.0, rhi = 0.0;
+  if (fgets(line, sizeof(line), iFile) == NULL)
+    PairTableError("Error reading pair table: no parameter line. Exiting now...", File, Keyword);
+  char * token = strtok(line, " \t\n");
+  while (token != NULL)
+  {
+    if (strcmp(token, "N") == 0)
+    {
+      double n = PairTableValue(File, Keyword);
+      N = (int) n;
+      if (N != n)
+        PairTableError("Error reading pair table: N is not an integer. Exiting now...", File, Keyword);
+    }
+    else if ((strcmp(token, "R") == 0) || (strcmp(token, "RSQ") == 0))
+    {
+      spacing = (strcmp(token, "R") == 0) ? 1 : 2;
+      rlo     = PairTableValue(File, Keyword);
+      rhi     = PairTableValue(File, Keyword);
+    }
+    token = strtok(NULL, " \t\n");
+  }
+
+  // The cubic splines need 3 points, and the force is divided by r
+  if (N < 3)
+  {
+    PrintMsg("Error reading pair table: less than 3 points (N). Exiting now...");
+    printf("\tThe table file was: %s (keyword %s, N = %d)\n", File, Keyword, N);
+    exit(EXIT_FAILURE);
+  }
+  if ((spacing != 0) && ((rlo <= 0.0) || (rhi <= rlo)))
+  {
+    PrintMsg("Error reading pair table: the range of r must be 0 < rlo < rhi. Exiting now...");
+    printf("\tThe table file was: %s (keyword %s, rlo = %f, rhi = %f)\n", File, Keyword, rlo, rhi);
+    exit(EXIT_FAILURE);
+  }
+
+  double * s = malloc(N*sizeof(double));
+  double * e = malloc(N*sizeof(double));
+  double * g = malloc(N*sizeof(double));
+
+  // Data lines: index r energy force
+  int    k = 0;
+  int    index;
+  double r, ek, fk;
+  while ((k < N) && (fgets(line, sizeof(line), iFile) != NULL))
+  {
+    if (sscanf(line, "%d %lf %lf %lf", &index, &r, &ek, &fk) != 4)
+      continue;
+    if (spacing == 1)
+      r = rlo + (rhi-rlo)*k/(N-1);
+    else if (spacing == 2)
+      r = sqrt(rlo*rlo + (rhi*rhi-rlo*rlo)*k/(N-1));
+    if ((r <= 0.0) || ((k > 0) && (r*r <= s[k-1])))
+    {
+      PrintMsg("Error reading pair table: r must be positive and increasing. Exiting now...");
+      printf("\tThe table file was: %s (keyword %s, point %d, r = %f)\n", File, Keyword, k+1, r);
+      exit(EXIT_FAILURE);
+    }
+    s[k] = r*r;
+    e[k] = ek;
+    g[k] = fk/r;
+    k++;
+  }
+  fclose(iFile);
+
+  if (k != N)
+  {
+    PrintMsg("Error reading pair table: missing points. Exiting now...");
+    printf("\tThe table file was: %s (keyword %s, %d of %d points)\n", File, Keyword, k, N);
+    exit(EXIT_FAILURE);
+  }
+
+  // Cubic splines of the energy and the force (divided by r) in r^2
+  gsl_interp_accel * acc = gsl_interp_accel_alloc();
+  gsl_spline * eSpline   = gsl_spline_alloc(gsl_interp_cspline, N);
+  gsl_spline * gSpline   = gsl_spline_alloc(gsl_interp_cspline, N);
+  gsl_spline_init(eSpline, s, e, N);
+  gsl_spline_init(gSpline, s, g, N);
+
+  // Resample the splines on PairTableN intervals of constant width in r^2, so
+  // that the interval of a pair is found without a search. Each interval is a
+  // cubic Hermite polynomial in u = (r2 - s_k)/h, u in [0,1)
+  pair->n      = PairTableN;
+  pair->s0     = s[0];
+  pair->ids    = PairTableN / (s[N-1] - s[0]);
+  pair->Spline = malloc(8*PairTableN*sizeof(double));
+
+  double h = 1.0 / pair->ids;
+  for (int i=0;i<PairTableN;i++)
+  {
+    double sa = s[0] + i*h;
+    double sb = (i == PairTableN-1) ? s[N-1] : sa + h;
+    gsl_spline * spline[2] = {eSpline, gSpline};
+    for (int q=0;q<2;q++)
+    {
+      double y0 = gsl_spline_eval(spline[q], sa, acc);
+      double y1 = gsl_spline_eval(spline[q], sb, acc);
+      double d0 = gsl_spline_eval_deriv(spline[q], sa, acc)*h;
+      double d1 = gsl_spline_eval_deriv(spline[q], sb, acc)*h;
+      double * c = pair->Spline + 8*i + 4*q;
+      c[0] = y0;
+      c[1] = d0;
+      c[2] = 3.0*(y1-y0) - 2.0*d0 - d1;
+      c[3] = 2.0*(y0-y1) + d0 + d1;
+    }
+  }
+
+  gsl_spline_free(eSpline);
+  gsl_spline_free(gSpline);
+  gsl_interp_accel_free(acc);
+
+  double rcut = sqrt(s[N-1]);
+
+  free(s);
+  free(e);
+  free(g);
+
+  return rcut;
+}
+
+void Compute_PairTable(void)
+{
+  double mass[NTypes]    = TypeMass;
+  double epsilon[NTypes] = TypeEpsilon;
+  double sigma[NTypes]   = TypeSigma;
+  double coeffs[][5]     = PairCoeffs;
+  int    ncoeffs         = sizeof(coeffs) / sizeof(coeffs[0]);
+
+  struct { int t1; int t2; char * File; char * Keyword; } tables[] = PairTables;
+  int    ntables         = sizeof(tables) / sizeof(tables[0]);
+  int    fluid[]         = FluidTypes;
+  int    wall[]          = WallTypes;
+  int    nfluid          = sizeof(fluid) / sizeof(fluid[0]);
+  int    nwall           = sizeof(wall) / sizeof(wall[0]);
+
+  // Fluid and wall types
+  for (int t=0;t<=NTypes;t++)
+    TypeClass[t] = -1;
+  for (int c=0;c<nfluid+nwall;c++)
+  {
+    int t = (c < nfluid) ? fluid[c] : wall[c-nfluid];
+    if ((t < 1) || (t > NTypes) || (TypeClass[t] != -1))
+    {
+      PrintMsg("Error in FluidTypes/WallTypes: type out of range or repeated. Exiting now...");
+      printf("\tType %d (NTypes = %d)\n", t, NTypes);
+      exit(EXIT_FAILURE);
+    }
+    TypeClass[t] = (c < nfluid) ? FluidType : WallType;
+  }
+
+  // Pair parameters before the shift: epsilon, sigma and rcut
+  double * eps = calloc((NTypes+1)*(NTypes+1), sizeof(double));
+  double * sig = calloc((NTypes+1)*(NTypes+1), sizeof(double));
+  double * rc  = calloc((NTypes+1)*(NTypes+1), sizeof(double));
+
+  MassTable[0] = 0.0;
+  for (int t1=1;t1<=NTypes;t1++)
+  {
+    MassTable[t1] = mass[t1-1];
+    for (int t2=1;t2<=NTypes;t2++)
+    {
+      int p  = t1*(NTypes+1)+t2;
+      eps[p] = sqrt(epsilon[t1-1]*epsilon[t2-1]);
+      #if MixingRule == Geometric
+        sig[p] = sqrt(sigma[t1-1]*sigma[t2-1]);
+      #else
+        sig[p] = 0.5*(sigma[t1-1]+sigma[t2-1]);
+      #endif
+      rc[p]  = Rcut;
+    }
+    // Like pairs are not mixed
+    eps[t1*(NTypes+2)] = epsilon[t1-1];
+    sig[t1*(NTypes+2)] = sigma[t1-1];
+  }
+
+  // Explicit pair coefficients override the mixing rule (in both orders)
+  for (int c=0;c<ncoeffs;c++)
+  {
+    int t1 = (int) coeffs[c][0];
+    int t2 = (int) coeffs[c][1];
+    if ((t1 < 1) || (t1 > NTypes) || (t2 < 1) || (t2 > NTypes))
+      continue;
+    if (coeffs[c][4] > Rcut)
+    {
+      PrintMsg("Error in PairCoeffs: the cut-off of a pair is larger than Rcut. Exiting now...");
+      printf("\tPair %d-%d has rcut = %f (Rcut = %f)\n", t1, t2, coeffs[c][4], Rcut);
+      exit(EXIT_FAILURE);
+    }
+    eps[t1*(NTypes+1)+t2] = eps[t2*(NTypes+1)+t1] = coeffs[c][2];
+    sig[t1*(NTypes+1)+t2] = sig[t2*(NTypes+1)+t1] = coeffs[c][3];
+    rc[t1*(NTypes+1)+t2]  = rc[t2*(NTypes+1)+t1]  = coeffs[c][4];
+  }
+
+  for (int p=0;p<(NTypes+1)*(NTypes+1);p++)
+  {
+    PairTable[p].Style   = Pair_LJ;
+    PairTable[p].epsilon = eps[p];
+    PairTable[p].sigma2  = (sig[p] > 0.0) ? sig[p]*sig[p] : 1.0;
+    PairTable[p].ecut    = 0.0;
+    PairTable[p].rcut2   = rc[p]*rc[p];
+    PairTable[p].Spline  = NULL;
+    #if ShiftLJ
+      if (rc[p] > 0.0)
+        PairTable[p].ecut = 4.0*eps[p]*(pow(sig[p]/rc[p],12)-pow(sig[p]/rc[p],6));
+    #endif
+  }
+
+  // Tabulated pairs replace the LJ interaction (in both orders)
+  for (int t=0;t<ntables;t++)
+  {
+    int t1 = tables[t].t1;
+    int t2 = tables[t].t2;
+    if ((t1 < 1) || (t1 > NTypes) || (t2 < 1) || (t2 > NTypes))
+      continue;
+
+    struct PairParameters * pair = PairTable + t1*(NTypes+1) + t2;
+    printf("\tPair %d-%d: table %s (%s)\n", t1, t2, tables[t].File, tables[t].Keyword);
+    double rcut = Read_PairTable(tables[t].File, tables[t].Keyword, pair);
+    if (rcut > Rcut + 1e-10)
+    {
+      PrintMsg("Error in PairTables: the cut-off of a table is larger than Rcut. Exiting now...");
+      printf("\tPair %d-%d has rcut = %f (Rcut = %f)\n", t1, t2, rcut, Rcut);
+      exit(EXIT_FAILURE);
+    }
+    pair->Style = Pair_Table;
+    pair->rcut2 = rcut*rcut;
+    PairTable[t2*(NTypes+1)+t1] = *pair;
+  }
+
+  AllPairsLJ = 1;
+  for (int p=0;p<(NTypes+1)*(NTypes+1);p++)
+    if (PairTable[p].Style != Pair_LJ)
+      AllPairsLJ = 0;
+
+  free(eps);
+  free(sig);
+  free(rc);
+}
+
+void FreePairTable(void)
+{
+  for (int t1=0;t1<=NTypes;t1++)
+  {
+    for (int t2=t1;t2<=NTypes;t2++)
+    {
+      // Both orders share the same spline
+      free(PairTable[t1*(NTypes+1)+t2].Spline);
+      PairTable[t1*(NTypes+1)+t2].Spline = NULL;
+      PairTable[t2*(NTypes+1)+t1].Spline = NULL;
+    }
+  }
+}
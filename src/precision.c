@@ -0,0 +1,108 @@
+/*
+ * Filename   : precision.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 20:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Validation of the single precision kernels against the double
+ *              precision path
+ *
+ */
+
+#include "cg.h"
+
+// Largest deviation of a profile relative to its largest absolute value (so
+// that nodes where the profile vanishes do not blow up the ratio)
+
+static double ProfileDeviation(gsl_vector * Test, gsl_vector * Reference)
+{
+  double MaxError = 0.0;
+  double MaxValue = 0.0;
+  for (int mu=0;mu<NNodes;mu++)
+  {
+    MaxError = max(MaxError, fabs(gsl_vector_get(Test,mu) - gsl_vector_get(Reference,mu)));
+    MaxValue = max(MaxValue, fabs(gsl_vector_get(Reference,mu)));
+  }
+  return (MaxValue > 0.0) ? MaxError/MaxValue : MaxError;
+}
+
+void Check_Precision(gsl_matrix * Positions, gsl_matrix * Velocities, gsl_matrix * Neighbors,
+                     gsl_vector * ListHead, gsl_vector * List, struct TypeList * Types,
+                     gsl_vector * z, int type1, int type2, struct WallGrid * Grid,
+                     gsl_matrix * Forces, gsl_vector * Energy)
+{
+  // Reference forces and energies with the double precision engine
+  gsl_matrix * ForcesRef  = gsl_matrix_calloc(NParticles,3);
+  gsl_vector * EnergyRef  = gsl_vector_calloc(NParticles);
+  gsl_vector * Kinetic    = gsl_vector_calloc(NParticles);
+  Compute_Forces(Positions, Velocities, Neighbors, ListHead, List, Types, type1, type2,
+                 Grid, NULL, ForcesRef, EnergyRef, Kinetic);
+
+  // Mesoscopic profiles that depend on the forces and energies. The stresses,
+  // the virial heat flux and the method of planes evaluate their pairs with
+  // Compute_Force_ij, so they do not depend on the engine
+  gsl_matrix * MesoForce    = gsl_matrix_calloc(NNodes,3);
+  gsl_matrix * MesoForceRef = gsl_matrix_calloc(NNodes,3);
+  gsl_vector * MesoEnergy    = gsl_vector_calloc(NNodes);
+  gsl_vector * MesoEnergyRef = gsl_vector_calloc(NNodes);
+  Compute_Meso_Force(Positions, Forces, z, MesoForce);
+  Compute_Meso_Force(Positions, ForcesRef, z, MesoForceRef);
+  Compute_Meso_Profile(Positions, Types, Energy, z, MesoEnergy, type1);
+  Compute_Meso_Profile(Positions, Types, EnergyRef, z, MesoEnergyRef, type1);
+
+  const char * Name[3] = {"MesoxForce", "MesoyForce", "MesozForce"};
+  for (int d=0;d<3;d++)
+  {
+    gsl_vector_view Test      = gsl_matrix_column(MesoForce,d);
+    gsl_vector_view Reference = gsl_matrix_column(MesoForceRef,d);
+    printf("\tMax. relative deviation of %s:\t%e\n", Name[d],
+           ProfileDeviation(&Test.vector, &Reference.vector));
+  }
+  printf("\tMax. relative deviation of MesoEnergy:\t%e\n",
+         ProfileDeviation(MesoEnergy, MesoEnergyRef));
+
+  // The convective heat flux carries the energy of each particle
+  #if __COMPUTE_HEAT_FLUX__
+    gsl_matrix * MesoHeat1    = gsl_matrix_calloc(NNodes,3);
+    gsl_matrix * MesoHeat1Ref = gsl_matrix_calloc(NNodes,3);
+    Compute_Meso_HeatFlux1(Positions, Velocities, Types, Energy, Kinetic, MesoHeat1, z);
+    Compute_Meso_HeatFlux1(Positions, Velocities, Types, EnergyRef, Kinetic, MesoHeat1Ref, z);
+
+    const char * HeatName[3] = {"MesoHeat1_x", "MesoHeat1_y", "MesoHeat1_z"};
+    for (int d=0;d<3;d++)
+    {
+      gsl_vector_view Test      = gsl_matrix_column(MesoHeat1,d);
+      gsl_vector_view Reference = gsl_matrix_column(MesoHeat1Ref,d);
+      printf("\tMax. relative deviation of %s:\t%e\n", HeatName[d],
+             ProfileDeviation(&Test.vector, &Reference.vector));
+    }
+    gsl_matrix_free(MesoHeat1);
+    gsl_matrix_free(MesoHeat1Ref);
+  #endif
+
+  // Per particle, relative to the largest force
+  double MaxError = 0.0;
+  double MaxForce = 0.0;
+  for (int k=Types->First[type1];k<Types->Last[type1];k++)
+  {
+    int i = Types->Index[k];
+    for (int d=0;d<3;d++)
+    {
+      MaxError = max(MaxError, fabs(gsl_matrix_get(Forces,i,d) - gsl_matrix_get(ForcesRef,i,d)));
+      MaxForce = max(MaxForce, fabs(gsl_matrix_get(ForcesRef,i,d)));
+    }
+  }
+  printf("\tMax. relative deviation of the particle forces:\t%e\n",
+         (MaxForce > 0.0) ? MaxError/MaxForce : MaxError);
+
+  gsl_matrix_free(ForcesRef);
+  gsl_vector_free(EnergyRef);
+  gsl_vector_free(Kinetic);
+  gsl_matrix_free(MesoForce);
+  gsl_matrix_free(MesoForceRef);
+  gsl_vector_free(MesoEnergy);
+  gsl_vector_free(MesoEnergyRef);
+}
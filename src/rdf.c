@@ -0,0 +1,180 @@
+/*
+ * Filename   : rdf.c
+ *
+ * Created    : 20.10.2026
+ *
+ * Modified   : mar 20 oct 2026 22:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Radial distribution functions by pair of types and element of
+ *              the central atom, accumulated in the force loop
+ *
+ */
+
+#include "cg.h"
+
+// Each thread has its own histograms, which are only added at the end.  The
+// histogram of the pair (a,b) around the atoms of type a in element mu is at
+// ((a*(NTypes+1) + b)*NNodes + mu)*RdfBins,  and the number of central atoms
+// at Centers + a*NNodes + mu. The pairs are normalized with the mean density
+// of type b in the box seen by an atom of type a:
+//   g_ab(r) = H_ab(r) / (N_a rho_b V_shell(r)),  rho_b = (N_b - delta_ab)/V
+//
+// The central atoms are those of RdfCenters, whatever the force engine. The
+// Verlet list engine histograms the fluid in its force loop, and Compute_RDF
+// the rest of the central atoms in a separate sweep.
+
+// 1 if atoms of type t are of type (0: all, -1: none)
+
+static int Covers(int type, int t)
+{
+  return (type == 0) || ((type > 0) && IsOfType(t, type));
+}
+
+int RDF_IsCenter(int t)
+{
+  return Covers(RdfCenters, t);
+}
+
+void AllocRDF(struct RDF * Rdf, gsl_vector * z)
+{
+  // The pairs come from the Verlet lists
+  if (RdfRmax > Rcut)
+  {
+    PrintMsg("Error in the radial distribution functions: RdfRmax is larger than Rcut. Exiting now...");
+    printf("\tRdfRmax = %f, Rcut = %f\n", RdfRmax, Rcut);
+    exit(EXIT_FAILURE);
+  }
+
+  if ((RdfCenters < 0) || (RdfCenters > FluidType))
+  {
+    PrintMsg("Error in the radial distribution functions: RdfCenters out of range. Exiting now...");
+    printf("\tRdfCenters = %d (NTypes = %d)\n", RdfCenters, NTypes);
+    exit(EXIT_FAILURE);
+  }
+
+  Rdf->z        = z;
+  Rdf->dr       = RdfRmax/RdfBins;
+  Rdf->NThreads = omp_get_max_threads();
+  Rdf->Size     = ((NTypes+1)*(NTypes+1)*RdfBins + (NTypes+1))*NNodes;
+  // One block per thread, placed in the node of its thread (see numa.c)
+  Rdf->Local    = AllocArray(Rdf->NThreads*Rdf->Size, sizeof(double));
+}
+
+void FreeRDF(struct RDF * Rdf)
+{
+  free(Rdf->Local);
+}
+
+double * RDF_Center(struct RDF * Rdf, gsl_matrix * Positions, int i)
+{
+  int      ti      = (int) gsl_matrix_get(Positions,i,0);
+  int      mu      = Element_Of(Rdf->z, gsl_matrix_get(Positions,i,3));
+  double * Local   = Rdf->Local + omp_get_thread_num()*Rdf->Size;
+  double * Centers = Local + (NTypes+1)*(NTypes+1)*RdfBins*NNodes;
+
+  Centers[ti*NNodes+mu] += 1.0;
+  return Local + (ti*(NTypes+1)*NNodes + mu)*RdfBins;
+}
+
+void RDF_Add(struct RDF * Rdf, double * Hist, gsl_matrix * Positions, int i, int j)
+{
+  double dx  = gsl_matrix_get(Positions,i,1) - gsl_matrix_get(Positions,j,1);
+         dx -= Lx*round(dx/Lx);
+  double dy  = gsl_matrix_get(Positions,i,2) - gsl_matrix_get(Positions,j,2);
+         dy -= Ly*round(dy/Ly);
+  double dz  = gsl_matrix_get(Positions,i,3) - gsl_matrix_get(Positions,j,3);
+         dz -= Lz*round(dz/Lz);
+
+  int b = (int) (sqrt(dx*dx + dy*dy + dz*dz)/Rdf->dr);
+  if (b < RdfBins)
+    Hist[(int) gsl_matrix_get(Positions,j,0)*NNodes*RdfBins + b] += 1.0;
+}
+
+void Compute_RDF(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                 gsl_vector * List, struct TypeList * Types, int Done, struct RDF * Rdf)
+{
+  // Central atoms not histogrammed by the force loop
+  int * Center  = malloc(NParticles*sizeof(int));
+  int   NCenter = 0;
+  for (int t=1;t<=NTypes;t++)
+  {
+    if (!RDF_IsCenter(t) || Covers(Done, t))
+      continue;
+    for (int k=Types->First[t];k<Types->Last[t];k++)
+      Center[NCenter++] = Types->Index[k];
+  }
+
+  #pragma omp parallel
+  {
+    int * Verlet = malloc(27 * NParticles * sizeof(int) / (Mx*My*Mz));
+
+    #pragma omp for schedule(dynamic,64)
+    for (int k=0;k<NCenter;k++)
+    {
+      int i     = Center[k];
+      int iCell = FindParticle(Positions,i);
+      gsl_vector_view NeighboringCells = gsl_matrix_row(Neighbors, iCell);
+      int NNeighbors = Compute_VerletList(Positions, i, &NeighboringCells.vector, iCell, ListHead, List, Verlet);
+
+      double * Hist = RDF_Center(Rdf, Positions, i);
+      for (int j=0;j<NNeighbors;j++)
+        RDF_Add(Rdf, Hist, Positions, i, Verlet[j]);
+    }
+
+    free(Verlet);
+  }
+
+  free(Center);
+}
+
+void SaveRDF(char * basename, struct RDF * Rdf, struct TypeList * Types)
+{
+  char   str[100];
+  double Volume = Lx*Ly*Lz;
+
+  // Sum of the histograms of the threads
+  double * Hist = calloc(Rdf->Size, sizeof(double));
+  for (int t=0;t<Rdf->NThreads;t++)
+    for (int l=0;l<Rdf->Size;l++)
+      Hist[l] += Rdf->Local[t*Rdf->Size + l];
+  double * Centers = Hist + (NTypes+1)*(NTypes+1)*RdfBins*NNodes;
+
+  for (int a=1;a<=NTypes;a++)
+  {
+    // Types that are not in RdfCenters have no central atoms
+    double NCenters = 0.0;
+    for (int mu=0;mu<NNodes;mu++)
+      NCenters += Centers[a*NNodes+mu];
+    if (NCenters == 0.0)
+      continue;
+
+    for (int b=1;b<=NTypes;b++)
+    {
+      // An atom is not its own neighbor
+      double rho = (Types->Last[b] - Types->First[b] - (a == b))/Volume;
+      if (rho <= 0.0)
+        continue;
+
+      sprintf(str, "./output/%s.MesoRDF_%d%d.avg.dat", basename, a, b);
+      FILE * oFile = fopen(str, "w");
+      for (int k=0;k<RdfBins;k++)
+      {
+        double r     = (k + 0.5)*Rdf->dr;
+        double Shell = 4.0/3.0*M_PI*(pow(k+1,3) - pow(k,3))*pow(Rdf->dr,3);
+        fprintf(oFile, "%8.6e", r);
+        for (int mu=0;mu<NNodes;mu++)
+        {
+          double N = Centers[a*NNodes+mu];
+          double H = Hist[((a*(NTypes+1) + b)*NNodes + mu)*RdfBins + k];
+          fprintf(oFile, "\t%8.6e", (N > 0.0) ? H/(N*rho*Shell) : 0.0);
+        }
+        fprintf(oFile, "\n");
+      }
+      fclose(oFile);
+    }
+  }
+
+  free(Hist);
+}
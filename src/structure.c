@@ -0,0 +1,176 @@
+/*
+ * Filename   : structure.c
+ *
+ * Created    : 20.10.2026
+ *
+ * Modified   : mar 20 oct 2026 20:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : In-plane structure factor S(k) of the fluid in each element,
+ *              from the FFT of the density on a xy grid
+ *
+ */
+
+#include "cg.h"
+
+// The particles of each element are assigned to the SkGridNx x SkGridNy grid
+// with a B-spline of order SkAssignment  (1 NGP, 2 CIC, 3 TSC).  The 2D FFT is
+// done by rows and then by columns. The assignment multiplies rho(k) by
+// W(kx) W(ky),  W(k) = sinc(k h/2)^SkAssignment,  which is divided out, and
+//   S(k) = |rho(k)|^2 / N
+// is averaged over the modes of each shell of |k| (SkBins shells up to the
+// Nyquist wave number of the grid) and over the snapshots.
+
+void AllocLayerSk(struct LayerSk * Sk)
+{
+  int    Nx   = SkGridNx;
+  int    Ny   = SkGridNy;
+  double hx   = Lx/Nx;
+  double hy   = Ly/Ny;
+  double kMax = M_PI*min(1.0/hx, 1.0/hy);
+
+  Sk->NFrames  = 0;
+  Sk->dk       = kMax/SkBins;
+  Sk->Bin      = malloc(Nx*Ny*sizeof(int));
+  Sk->Window   = malloc(Nx*Ny*sizeof(double));
+  Sk->Sum      = calloc(SkBins*NNodes, sizeof(double));
+  Sk->Count    = calloc(SkBins*NNodes, sizeof(double));
+  Sk->Particle = malloc(NParticles*sizeof(int));
+  Sk->First    = malloc((NNodes+1)*sizeof(int));
+
+  for (int iy=0;iy<Ny;iy++)
+  {
+    for (int ix=0;ix<Nx;ix++)
+    {
+      // Wave numbers of the FFT (the second half are the negative ones)
+      double kx = 2.0*M_PI/Lx*((ix <= Nx/2) ? ix : ix - Nx);
+      double ky = 2.0*M_PI/Ly*((iy <= Ny/2) ? iy : iy - Ny);
+      double k  = sqrt(kx*kx + ky*ky);
+      int    b  = (int) (k/Sk->dk);
+
+      double Wx = (ix == 0) ? 1.0 : sin(0.5*kx*hx)/(0.5*kx*hx);
+      double Wy = (iy == 0) ? 1.0 : sin(0.5*ky*hy)/(0.5*ky*hy);
+      double W  = pow(Wx*Wy, SkAssignment);
+
+      Sk->Bin[iy*Nx+ix]    = ((k == 0.0) || (b >= SkBins)) ? -1 : b;
+      Sk->Window[iy*Nx+ix] = 1.0/(W*W);
+    }
+  }
+}
+
+void FreeLayerSk(struct LayerSk * Sk)
+{
+  free(Sk->Bin);
+  free(Sk->Window);
+  free(Sk->Sum);
+  free(Sk->Count);
+  free(Sk->Particle);
+  free(Sk->First);
+}
+
+// Weights of the SkAssignment grid points from First (periodic) for the
+// coordinate u in units of the grid spacing
+
+static inline int Sk_Weights(double u, double * w)
+{
+  #if SkAssignment == 1
+    w[0] = 1.0;
+    return (int) floor(u + 0.5);
+  #elif SkAssignment == 2
+    double f = floor(u);
+    double t = u - f;
+    w[0] = 1.0 - t;
+    w[1] = t;
+    return (int) f;
+  #else
+    double f = floor(u + 0.5);
+    double d = u - f;
+    w[0] = 0.5*(0.5 - d)*(0.5 - d);
+    w[1] = 0.75 - d*d;
+    w[2] = 0.5*(0.5 + d)*(0.5 + d);
+    return (int) f - 1;
+  #endif
+}
+
+void Compute_LayerSk(struct LayerSk * Sk, gsl_matrix * Positions, struct TypeList * Types,
+                     gsl_vector * z)
+{
+  int Nx = SkGridNx;
+  int Ny = SkGridNy;
+
+  Compute_Element_Bins(Positions, Types, FluidType, z, Sk->Particle, Sk->First);
+
+  #pragma omp parallel
+  {
+    double * Rho = malloc(2*Nx*Ny*sizeof(double));
+
+    #pragma omp for schedule(dynamic)
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      int N = Sk->First[mu+1] - Sk->First[mu];
+      if (N == 0)
+        continue;
+
+      // Density on the grid (complex, interleaved)
+      for (int l=0;l<2*Nx*Ny;l++)
+        Rho[l] = 0.0;
+      for (int p=Sk->First[mu];p<Sk->First[mu+1];p++)
+      {
+        int    i = Sk->Particle[p];
+        double wx[SkAssignment], wy[SkAssignment];
+        int    gx = Sk_Weights(gsl_matrix_get(Positions,i,1)*Nx/Lx, wx);
+        int    gy = Sk_Weights(gsl_matrix_get(Positions,i,2)*Ny/Ly, wy);
+        for (int b=0;b<SkAssignment;b++)
+        {
+          int iy = ((gy + b) % Ny + Ny) % Ny;
+          for (int a=0;a<SkAssignment;a++)
+          {
+            int ix = ((gx + a) % Nx + Nx) % Nx;
+            Rho[2*(iy*Nx+ix)] += wx[a]*wy[b];
+          }
+        }
+      }
+
+      for (int iy=0;iy<Ny;iy++)
+        gsl_fft_complex_radix2_forward(Rho + 2*iy*Nx, 1, Nx);
+      for (int ix=0;ix<Nx;ix++)
+        gsl_fft_complex_radix2_forward(Rho + 2*ix, Nx, Ny);
+
+      for (int l=0;l<Nx*Ny;l++)
+      {
+        int b = Sk->Bin[l];
+        if (b < 0)
+          continue;
+        double S = (Rho[2*l]*Rho[2*l] + Rho[2*l+1]*Rho[2*l+1])*Sk->Window[l]/N;
+        Sk->Sum[b*NNodes+mu]   += S;
+        Sk->Count[b*NNodes+mu] += 1.0;
+      }
+    }
+
+    free(Rho);
+  }
+
+  Sk->NFrames++;
+}
+
+void SaveLayerSk(char * basename, struct LayerSk * Sk)
+{
+  char str[100];
+
+  sprintf(str, "./output/%s.MesoSk.avg.dat", basename);
+  FILE * oFile = fopen(str, "w");
+
+  for (int b=0;b<SkBins;b++)
+  {
+    fprintf(oFile, "%8.6e", (b + 0.5)*Sk->dk);
+    for (int mu=0;mu<NNodes;mu++)
+    {
+      double c = Sk->Count[b*NNodes+mu];
+      fprintf(oFile, "\t%8.6e", (c > 0.0) ? Sk->Sum[b*NNodes+mu]/c : 0.0);
+    }
+    fprintf(oFile, "\n");
+  }
+
+  fclose(oFile);
+}
@@ -0,0 +1,250 @@
+/*
+ * Filename   : wallgrid.c
+ *
+ * Created    : 19.10.2026
+ *
+ * Modified   : lun 19 oct 2026 10:00:00 CEST
+ *
+ * Author     : jatorre
+ *
+ * Purpose    : Tabulated wall potential for rigid (or nearly rigid) walls
+ *
+ */
+
+#include "cg.h"
+
+// The grid is periodic in x, y and z. Node (ix,iy,iz) is located at
+// (ix*dx, iy*dy, iz*dz) and it stores fx, fy, fz and the energy that a fluid
+// particle would feel there due to all the wall particles of the reference
+// configuration. There is one grid per fluid type (slot).
+
+static double * WallGridNode(struct WallGrid * Grid, int slot, int ix, int iy, int iz)
+{
+  return Grid->Table + 4*((((long) slot*Grid->Nz + iz)*Grid->Ny + iy)*Grid->Nx + ix);
+}
+
+// Force and energy at (x,y,z) due to all the wall particles within Rcut. Pairs
+// closer than rcore see the force of distance rcore and an energy that grows
+// linearly with it, so the table has no singularities at the wall atoms. Fluid
+// particles never get that close, and rcore = 0 gives the exact pair
+
+static double WallGridExact(gsl_matrix * Positions, gsl_matrix * Neighbors,
+                            gsl_vector * ListHead, gsl_vector * List,
+                            int type, double x, double y, double z, double rcore,
+                            double * f)
+{
+  double e = 0.0;
+  f[0] = 0.0;
+  f[1] = 0.0;
+  f[2] = 0.0;
+
+  int cell = floor(x*Mx/Lx) + floor(y*My/Ly)*Mx + floor(z*Mz/Lz)*Mx*My;
+
+  for (int c=0;c<27;c++)
+  {
+    int icell = gsl_matrix_get(Neighbors,cell,c);
+    int j     = gsl_vector_get(ListHead,icell);
+    while (j >= 0)
+    {
+      int tj = (int) gsl_matrix_get(Positions,j,0);
+      if (TypeClass[tj] == WallType)
+      {
+        // Parameters of the fluid-wall pair
+        const struct PairParameters * pair = PairTable + type*(NTypes+1) + tj;
+
+        double deltax  = x - gsl_matrix_get(Positions,j,1);
+               deltax -= Lx*round(deltax/Lx);
+        double deltay  = y - gsl_matrix_get(Positions,j,2);
+               deltay -= Ly*round(deltay/Ly);
+        double deltaz  = z - gsl_matrix_get(Positions,j,3);
+               deltaz -= Lz*round(deltaz/Lz);
+
+        double r2 = deltax*deltax + deltay*deltay + deltaz*deltaz;
+
+        if ((r2 != 0)&&(r2 <= pair->rcut2))
+        {
+          double ff;
+          if (r2 < rcore*rcore)
+          {
+            double r = sqrt(r2);
+            e  += Eval_Pair(pair, rcore*rcore, &ff);
+            ff *= rcore;
+            e  += ff*(rcore-r);
+            ff /= r;
+          }
+          else
+            e  += Eval_Pair(pair, r2, &ff);
+          f[0] += ff*deltax;
+          f[1] += ff*deltay;
+          f[2] += ff*deltaz;
+        }
+      }
+      j = gsl_vector_get(List,j);
+    }
+  }
+  return e;
+}
+
+void Compute_WallGrid(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                      gsl_vector * List, struct TypeList * Types, struct Ordering * Order,
+                      struct WallGrid * Grid)
+{
+  int Fluid[NTypes];
+
+  Grid->Nx        = WallGridNx;
+  Grid->Ny        = WallGridNy;
+  Grid->Nz        = WallGridNz;
+  Grid->dx        = Lx / WallGridNx;
+  Grid->dy        = Ly / WallGridNy;
+  Grid->dz        = Lz / WallGridNz;
+  Grid->NFluid    = 0;
+  for (int t=1;t<=NTypes;t++)
+  {
+    Grid->Slot[t] = -1;
+    if (TypeClass[t] == FluidType)
+    {
+      Fluid[Grid->NFluid] = t;
+      Grid->Slot[t]       = Grid->NFluid++;
+    }
+  }
+  Grid->Table     = malloc(4 * (long) Grid->NFluid * Grid->Nx * Grid->Ny * Grid->Nz * sizeof(double));
+
+  // Store the reference configuration of the wall to check its drift. Rows
+  // follow the input files, so the reference survives the spatial reordering
+  Grid->Reference = gsl_matrix_calloc(NParticles,3);
+  for (int k=Types->First[WallType];k<Types->Last[WallType];k++)
+  {
+    int i  = Types->Index[k];
+    int id = Order->Id[i];
+    gsl_matrix_set(Grid->Reference,id,0,gsl_matrix_get(Positions,i,1));
+    gsl_matrix_set(Grid->Reference,id,1,gsl_matrix_get(Positions,i,2));
+    gsl_matrix_set(Grid->Reference,id,2,gsl_matrix_get(Positions,i,3));
+  }
+
+  #pragma omp parallel for schedule(dynamic) collapse(3)
+  for (int slot=0;slot<Grid->NFluid;slot++)
+  {
+    for (int iz=0;iz<Grid->Nz;iz++)
+    {
+      for (int iy=0;iy<Grid->Ny;iy++)
+      {
+        for (int ix=0;ix<Grid->Nx;ix++)
+        {
+          double * node = WallGridNode(Grid,slot,ix,iy,iz);
+          node[3] = WallGridExact(Positions, Neighbors, ListHead, List, Fluid[slot],
+                                  ix*Grid->dx, iy*Grid->dy, iz*Grid->dz, WallGridRcore, node);
+        }
+      }
+    }
+  }
+}
+
+double InterpolateWallGrid(struct WallGrid * Grid, int type, double x, double y, double z,
+                           double * f)
+{
+  int slot = Grid->Slot[type];
+
+  double gx = x / Grid->dx;
+  double gy = y / Grid->dy;
+  double gz = z / Grid->dz;
+
+  int ix = (int) floor(gx);
+  int iy = (int) floor(gy);
+  int iz = (int) floor(gz);
+
+  double tx = gx - ix;
+  double ty = gy - iy;
+  double tz = gz - iz;
+
+  // PBC
+  ix = ((ix % Grid->Nx) + Grid->Nx) % Grid->Nx;
+  iy = ((iy % Grid->Ny) + Grid->Ny) % Grid->Ny;
+  iz = ((iz % Grid->Nz) + Grid->Nz) % Grid->Nz;
+  int ixp = (ix+1) % Grid->Nx;
+  int iyp = (iy+1) % Grid->Ny;
+  int izp = (iz+1) % Grid->Nz;
+
+  // Trilinear interpolation of the four tabulated quantities
+  double w[8] = {(1-tx)*(1-ty)*(1-tz), tx*(1-ty)*(1-tz), (1-tx)*ty*(1-tz), tx*ty*(1-tz),
+                 (1-tx)*(1-ty)*tz,     tx*(1-ty)*tz,     (1-tx)*ty*tz,     tx*ty*tz};
+  double * node[8] = {WallGridNode(Grid,slot,ix ,iy ,iz ), WallGridNode(Grid,slot,ixp,iy ,iz ),
+                      WallGridNode(Grid,slot,ix ,iyp,iz ), WallGridNode(Grid,slot,ixp,iyp,iz ),
+                      WallGridNode(Grid,slot,ix ,iy ,izp), WallGridNode(Grid,slot,ixp,iy ,izp),
+                      WallGridNode(Grid,slot,ix ,iyp,izp), WallGridNode(Grid,slot,ixp,iyp,izp)};
+
+  double e = 0.0;
+  f[0] = 0.0;
+  f[1] = 0.0;
+  f[2] = 0.0;
+  for (int c=0;c<8;c++)
+  {
+    f[0] += w[c]*node[c][0];
+    f[1] += w[c]*node[c][1];
+    f[2] += w[c]*node[c][2];
+    e    += w[c]*node[c][3];
+  }
+  return e;
+}
+
+double Compute_WallGrid_Drift(gsl_matrix * Positions, struct TypeList * Types,
+                              struct Ordering * Order, struct WallGrid * Grid)
+{
+  double drift2 = 0.0;
+
+  for (int k=Types->First[WallType];k<Types->Last[WallType];k++)
+  {
+    int i  = Types->Index[k];
+    int id = Order->Id[i];
+    double deltax  = gsl_matrix_get(Positions,i,1) - gsl_matrix_get(Grid->Reference,id,0);
+           deltax -= Lx*round(deltax/Lx);
+    double deltay  = gsl_matrix_get(Positions,i,2) - gsl_matrix_get(Grid->Reference,id,1);
+           deltay -= Ly*round(deltay/Ly);
+    double deltaz  = gsl_matrix_get(Positions,i,3) - gsl_matrix_get(Grid->Reference,id,2);
+           deltaz -= Lz*round(deltaz/Lz);
+    double r2 = deltax*deltax + deltay*deltay + deltaz*deltaz;
+    if (r2 > drift2)
+      drift2 = r2;
+  }
+  return sqrt(drift2);
+}
+
+void Check_WallGrid(gsl_matrix * Positions, gsl_matrix * Neighbors, gsl_vector * ListHead,
+                    gsl_vector * List, struct TypeList * Types, struct WallGrid * Grid)
+{
+  double f[3], fexact[3];
+  double MaxError = 0.0;
+  double MaxForce = 0.0;
+
+  for (int k=Types->First[FluidType];k<Types->Last[FluidType];k++)
+  {
+    int i    = Types->Index[k];
+    int type = (int) gsl_matrix_get(Positions,i,0);
+    double x = gsl_matrix_get(Positions,i,1);
+    double y = gsl_matrix_get(Positions,i,2);
+    double z = gsl_matrix_get(Positions,i,3);
+
+    InterpolateWallGrid(Grid, type, x, y, z, f);
+    WallGridExact(Positions, Neighbors, ListHead, List, type, x, y, z, 0.0, fexact);
+
+    double error = sqrt(pow(f[0]-fexact[0],2) + pow(f[1]-fexact[1],2) + pow(f[2]-fexact[2],2));
+    double force = sqrt(pow(fexact[0],2) + pow(fexact[1],2) + pow(fexact[2],2));
+    MaxError = max(MaxError, error);
+    MaxForce = max(MaxForce, force);
+  }
+  printf("\tWall grid of %d x %d x %d nodes, %d fluid types (%.1f MB)\n", Grid->Nx, Grid->Ny,
+         Grid->Nz, Grid->NFluid, 4.0 * Grid->NFluid * Grid->Nx * Grid->Ny * Grid->Nz * sizeof(double) / 1048576.0);
+  printf("\tMax. error in the wall force: %e (max. wall force: %e)\n", MaxError, MaxForce);
+
+  if (MaxError > WallGridMaxError*MaxForce)
+  {
+    PrintMsg("Error in the wall grid: it is not accurate enough. Exiting now...");
+    printf("\tRefine the grid (WallGridNx, WallGridNy, WallGridNz)\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void FreeWallGrid(struct WallGrid * Grid)
+{
+  free(Grid->Table);
+  gsl_matrix_free(Grid->Reference);
+}